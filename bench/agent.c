@@ -0,0 +1,707 @@
+/*
+ *    bench_agent . Synthetic SNMP agent for the benchmarks of the plugins
+ *
+ *    Copyright (C) 2006  Vincent GERARD v.ge@wanadoo.fr
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; see the file COPYING. If not, write to the
+ *    Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * A small SNMP v1/v2c agent (GET, GETNEXT, GETBULK, any community) serving
+ * the objects read by the plugins, with as many rows as asked :
+ *   sysUpTime, hrStorageTable, hrProcessorTable, hrSWRunTable,
+ *   hrSWRunPerfTable, laTable (UCD-SNMP-MIB)
+ * The rows are not stored : the object following an OID and its value are
+ * computed, so 50000 rows cost no memory.
+ *
+ * The requests, varbinds and bytes received and sent are counted. On
+ * SIGUSR1 they are written in the stats file (-S) and reset :
+ *	requests N varbinds N bytes_in N bytes_out N
+ *
+ * No net-snmp : the agent must not share the code it measures.
+ */
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define AGENT_PORT 16161
+#define AGENT_MSG_MAX 65507
+#define AGENT_MSG_SIZE 1472     // default max size of a response : one ethernet frame
+#define AGENT_OID_MAX 32
+#define AGENT_VARBINDS_MAX 256
+
+/* BER tags */
+#define BER_INTEGER 0x02
+#define BER_OCTET_STR 0x04
+#define BER_NULL 0x05
+#define BER_OID 0x06
+#define BER_SEQUENCE 0x30
+#define BER_GAUGE 0x42
+#define BER_TIMETICKS 0x43
+#define BER_NOSUCHINSTANCE 0x81
+#define BER_ENDOFMIBVIEW 0x82
+
+#define PDU_GET 0xA0
+#define PDU_GETNEXT 0xA1
+#define PDU_RESPONSE 0xA2
+#define PDU_GETBULK 0xA5
+
+#define ERR_TOOBIG 1
+#define ERR_NOSUCHNAME 2
+
+typedef unsigned int t_subid;
+
+typedef struct varoid {
+    t_subid name[AGENT_OID_MAX];
+    int length;
+} t_oid;
+
+/* A column of a table (or a scalar) : prefix.index, index = first .. first + rows - 1 */
+typedef struct column {
+    t_subid prefix[12];
+    int length;
+    int first;
+    int *rows;
+    int id;
+} t_column;
+
+enum {
+    SYS_UPTIME, STORAGE_INDEX, STORAGE_TYPE, STORAGE_DESCR, STORAGE_UNITS, STORAGE_SIZE, STORAGE_USED,
+    STORAGE_FAILURES, PROC_FRWID, PROC_LOAD, RUN_INDEX, RUN_NAME, RUN_PATH, RUN_PARAMS, RUN_TYPE, RUN_STATUS,
+    PERF_CPU, PERF_MEM, LA_INDEX, LA_NAMES, LA_LOAD, LA_CONFIG, LA_LOADINT
+};
+
+static int storage_rows = 100, process_rows = 100, cpu_rows = 4, la_rows = 3, one_row = 1;
+
+/* In the order of their OIDs */
+static t_column columns[] = {
+    { { 1, 3, 6, 1, 2, 1, 1, 3 }, 8, 0, &one_row, SYS_UPTIME },
+    { { 1, 3, 6, 1, 2, 1, 25, 2, 3, 1, 1 }, 11, 1, &storage_rows, STORAGE_INDEX },
+    { { 1, 3, 6, 1, 2, 1, 25, 2, 3, 1, 2 }, 11, 1, &storage_rows, STORAGE_TYPE },
+    { { 1, 3, 6, 1, 2, 1, 25, 2, 3, 1, 3 }, 11, 1, &storage_rows, STORAGE_DESCR },
+    { { 1, 3, 6, 1, 2, 1, 25, 2, 3, 1, 4 }, 11, 1, &storage_rows, STORAGE_UNITS },
+    { { 1, 3, 6, 1, 2, 1, 25, 2, 3, 1, 5 }, 11, 1, &storage_rows, STORAGE_SIZE },
+    { { 1, 3, 6, 1, 2, 1, 25, 2, 3, 1, 6 }, 11, 1, &storage_rows, STORAGE_USED },
+    { { 1, 3, 6, 1, 2, 1, 25, 2, 3, 1, 7 }, 11, 1, &storage_rows, STORAGE_FAILURES },
+    { { 1, 3, 6, 1, 2, 1, 25, 3, 3, 1, 1 }, 11, 1, &cpu_rows, PROC_FRWID },
+    { { 1, 3, 6, 1, 2, 1, 25, 3, 3, 1, 2 }, 11, 1, &cpu_rows, PROC_LOAD },
+    { { 1, 3, 6, 1, 2, 1, 25, 4, 2, 1, 1 }, 11, 1, &process_rows, RUN_INDEX },
+    { { 1, 3, 6, 1, 2, 1, 25, 4, 2, 1, 2 }, 11, 1, &process_rows, RUN_NAME },
+    { { 1, 3, 6, 1, 2, 1, 25, 4, 2, 1, 4 }, 11, 1, &process_rows, RUN_PATH },
+    { { 1, 3, 6, 1, 2, 1, 25, 4, 2, 1, 5 }, 11, 1, &process_rows, RUN_PARAMS },
+    { { 1, 3, 6, 1, 2, 1, 25, 4, 2, 1, 6 }, 11, 1, &process_rows, RUN_TYPE },
+    { { 1, 3, 6, 1, 2, 1, 25, 4, 2, 1, 7 }, 11, 1, &process_rows, RUN_STATUS },
+    { { 1, 3, 6, 1, 2, 1, 25, 5, 1, 1, 1 }, 11, 1, &process_rows, PERF_CPU },
+    { { 1, 3, 6, 1, 2, 1, 25, 5, 1, 1, 2 }, 11, 1, &process_rows, PERF_MEM },
+    { { 1, 3, 6, 1, 4, 1, 2021, 10, 1, 1 }, 10, 1, &la_rows, LA_INDEX },
+    { { 1, 3, 6, 1, 4, 1, 2021, 10, 1, 2 }, 10, 1, &la_rows, LA_NAMES },
+    { { 1, 3, 6, 1, 4, 1, 2021, 10, 1, 3 }, 10, 1, &la_rows, LA_LOAD },
+    { { 1, 3, 6, 1, 4, 1, 2021, 10, 1, 4 }, 10, 1, &la_rows, LA_CONFIG },
+    { { 1, 3, 6, 1, 4, 1, 2021, 10, 1, 5 }, 10, 1, &la_rows, LA_LOADINT },
+};
+
+#define NCOLUMNS (int)(sizeof(columns) / sizeof(t_column))
+
+static struct timeval started;
+static volatile sig_atomic_t dump_stats = 0;
+static unsigned long stat_requests, stat_varbinds, stat_bytes_in, stat_bytes_out;
+
+/*
+ * oid_cmp : order of two OIDs
+ */
+
+static int oid_cmp(const t_subid *a, int alen, const t_subid *b, int blen)
+{
+    int count;
+
+    for (count = 0; count < alen && count < blen; count++) {
+        if (a[count] != b[count])
+            return a[count] < b[count] ? -1 : 1;
+    }
+
+    return (alen > blen) - (alen < blen);
+}
+
+/*
+ * value : type and value of a row of a column
+ *
+ * return : BER type, *integer or *string / *strlen or *objid / *objlen set
+ */
+
+static int value(int id, int index, long *integer, char *string, int *strlen_, const t_subid **objid, int *objlen)
+{
+    static const t_subid ram[] = { 1, 3, 6, 1, 2, 1, 25, 2, 1, 2 };
+    static const t_subid vmem[] = { 1, 3, 6, 1, 2, 1, 25, 2, 1, 3 };
+    static const t_subid disk[] = { 1, 3, 6, 1, 2, 1, 25, 2, 1, 4 };
+    static const t_subid zero[] = { 0, 0 };
+    struct timeval now;
+
+    switch (id) {
+    case SYS_UPTIME:
+        gettimeofday(&now, NULL);
+        *integer = (now.tv_sec - started.tv_sec) * 100 + (now.tv_usec - started.tv_usec) / 10000;
+        return BER_TIMETICKS;
+    case STORAGE_INDEX:
+    case RUN_INDEX:
+    case LA_INDEX:
+        *integer = index;
+        return BER_INTEGER;
+    case STORAGE_TYPE:
+        *objid = index == 1 ? ram : index == 2 ? vmem : disk;
+        *objlen = 10;
+        return BER_OID;
+    case STORAGE_DESCR:
+        if (index == 1)
+            *strlen_ = sprintf(string, "Physical memory");
+        else if (index == 2)
+            *strlen_ = sprintf(string, "Virtual memory");
+        else
+            *strlen_ = sprintf(string, "/srv/volume%d", index);
+        return BER_OCTET_STR;
+    case STORAGE_UNITS:
+        *integer = 4096;
+        return BER_INTEGER;
+    case STORAGE_SIZE:
+        *integer = 1000000 + index;
+        return BER_INTEGER;
+    case STORAGE_USED:
+        *integer = (1000000 + index) / 100 * (index % 100);
+        return BER_INTEGER;
+    case STORAGE_FAILURES:
+        *integer = 0;
+        return BER_INTEGER;
+    case PROC_FRWID:
+        *objid = zero;
+        *objlen = 2;
+        return BER_OID;
+    case PROC_LOAD:
+        *integer = (index * 37) % 101;
+        return BER_INTEGER;
+    case RUN_NAME:
+        *strlen_ = sprintf(string, "proc%d", index % 100);
+        return BER_OCTET_STR;
+    case RUN_PATH:
+        *strlen_ = sprintf(string, "/usr/bin/proc%d", index % 100);
+        return BER_OCTET_STR;
+    case RUN_PARAMS:
+        *strlen_ = sprintf(string, "--worker %d", index);
+        return BER_OCTET_STR;
+    case RUN_TYPE:
+        *integer = 4;
+        return BER_INTEGER;
+    case RUN_STATUS:
+        *integer = 1;
+        return BER_INTEGER;
+    case PERF_CPU:
+        *integer = index * 13;
+        return BER_INTEGER;
+    case PERF_MEM:
+        *integer = 1024 + (index * 97) % 65536;
+        return BER_INTEGER;
+    case LA_NAMES:
+        *strlen_ = sprintf(string, "Load-%d", index == 1 ? 1 : index == 2 ? 5 : 15);
+        return BER_OCTET_STR;
+    case LA_LOAD:
+        *strlen_ = sprintf(string, "%d.%02d", index / 2, 10 * index);
+        return BER_OCTET_STR;
+    case LA_CONFIG:
+        *strlen_ = sprintf(string, "12.00");
+        return BER_OCTET_STR;
+    case LA_LOADINT:
+        *integer = 100 * (index / 2) + 10 * index;
+        return BER_INTEGER;
+    }
+
+    return BER_NULL;
+}
+
+/*
+ * lookup : object at an OID (GET) or after it (GETNEXT)
+ *
+ * return : column index, name set to the object found, or -1 if none
+ */
+
+static int lookup(t_oid *name, int next, int *index)
+{
+    t_column *column;
+    int count, cmp;
+
+    for (count = 0; count < NCOLUMNS; count++) {
+        column = &columns[count];
+        if (*column->rows <= 0)
+            continue;
+
+        cmp = oid_cmp(name->name, name->length < column->length ? name->length : column->length, column->prefix,
+                      column->length);
+
+        if (!next) {
+            if (cmp == 0 && name->length == column->length + 1 && (int)name->name[column->length] >= column->first &&
+                (int)name->name[column->length] < column->first + *column->rows) {
+                *index = name->name[column->length];
+                return count;
+            }
+            continue;
+        }
+
+        if (cmp > 0)
+            continue;
+
+        if (cmp < 0 || name->length <= column->length) {
+            /* Before the column : its first row */
+            *index = column->first;
+        } else {
+            /* In the column : the row after */
+            *index = (int)name->name[column->length] < column->first ? column->first :
+                (int)name->name[column->length] + 1;
+            if (*index >= column->first + *column->rows)
+                continue;
+        }
+
+        memcpy(name->name, column->prefix, column->length * sizeof(t_subid));
+        name->name[column->length] = *index;
+        name->length = column->length + 1;
+        return count;
+    }
+
+    return -1;
+}
+
+/* BER encoding : each function writes at p, returns the bytes written */
+
+static int ber_length(unsigned char *p, int length)
+{
+    if (length < 128) {
+        p[0] = length;
+        return 1;
+    }
+    if (length < 256) {
+        p[0] = 0x81;
+        p[1] = length;
+        return 2;
+    }
+    p[0] = 0x82;
+    p[1] = length >> 8;
+    p[2] = length & 0xff;
+    return 3;
+}
+
+static int ber_header(unsigned char *p, int tag, int length)
+{
+    p[0] = tag;
+    return 1 + ber_length(p + 1, length);
+}
+
+static int ber_integer(unsigned char *p, int tag, long value)
+{
+    unsigned char buf[9];
+    int length = 0, count;
+
+    /* Big endian, two's complement, minimal length */
+    do {
+        buf[length++] = value & 0xff;
+        value >>= 8;
+    } while (length < 8 && !(value == 0 && !(buf[length - 1] & 0x80)) &&
+             !(value == -1 && (buf[length - 1] & 0x80)));
+
+    count = ber_header(p, tag, length);
+    while (length > 0)
+        p[count++] = buf[--length];
+
+    return count;
+}
+
+static int ber_subid(unsigned char *p, t_subid subid)
+{
+    unsigned char buf[5];
+    int length = 0, count = 0;
+
+    do {
+        buf[length++] = subid & 0x7f;
+        subid >>= 7;
+    } while (subid);
+
+    while (length > 0) {
+        p[count] = buf[--length];
+        if (length)
+            p[count] |= 0x80;
+        count++;
+    }
+
+    return count;
+}
+
+static int ber_oid(unsigned char *p, const t_subid *name, int length)
+{
+    unsigned char buf[AGENT_OID_MAX * 5];
+    int size, count;
+
+    if (length < 2)
+        return ber_header(p, BER_OID, 0);
+
+    size = ber_subid(buf, name[0] * 40 + name[1]);
+    for (count = 2; count < length; count++)
+        size += ber_subid(buf + size, name[count]);
+
+    count = ber_header(p, BER_OID, size);
+    memcpy(p + count, buf, size);
+
+    return count + size;
+}
+
+/*
+ * ber_varbind : encode a varbind
+ *
+ *	args : type = BER type of the value, or 0 to encode the object of
+ *		      column / index
+ */
+
+static int ber_varbind(unsigned char *p, const t_oid *name, int type, int column, int index)
+{
+    unsigned char buf[512];
+    char string[64];
+    const t_subid *objid = NULL;
+    long integer = 0;
+    int size, length = 0, objlen = 0;
+
+    size = ber_oid(buf, name->name, name->length);
+
+    if (type == 0)
+        type = value(columns[column].id, index, &integer, string, &length, &objid, &objlen);
+    switch (type) {
+    case BER_INTEGER:
+    case BER_GAUGE:
+    case BER_TIMETICKS:
+        size += ber_integer(buf + size, type, integer);
+        break;
+    case BER_OCTET_STR:
+        size += ber_header(buf + size, type, length);
+        memcpy(buf + size, string, length);
+        size += length;
+        break;
+    case BER_OID:
+        size += ber_oid(buf + size, objid, objlen);
+        break;
+    default:
+        size += ber_header(buf + size, type, 0);
+        break;
+    }
+
+    length = ber_header(p, BER_SEQUENCE, size);
+    memcpy(p + length, buf, size);
+
+    return length + size;
+}
+
+/* BER decoding : read at *p (up to end), advance *p */
+
+static int ber_read_header(const unsigned char **p, const unsigned char *end, int *tag, int *length)
+{
+    int count;
+
+    if (end - *p < 2)
+        return -1;
+
+    *tag = *(*p)++;
+    *length = *(*p)++;
+    if (*length & 0x80) {
+        count = *length & 0x7f;
+        if (count > 3 || end - *p < count)
+            return -1;
+        for (*length = 0; count > 0; count--)
+            *length = (*length << 8) | *(*p)++;
+    }
+
+    return *length <= end - *p ? 0 : -1;
+}
+
+static int ber_read_integer(const unsigned char **p, const unsigned char *end, long *value)
+{
+    int tag, length;
+
+    if (ber_read_header(p, end, &tag, &length) != 0 || tag != BER_INTEGER || length < 1 || length > 8)
+        return -1;
+
+    *value = (**p & 0x80) ? -1 : 0;
+    while (length-- > 0)
+        *value = (*value << 8) | *(*p)++;
+
+    return 0;
+}
+
+static int ber_read_oid(const unsigned char **p, const unsigned char *end, t_oid *name)
+{
+    const unsigned char *stop;
+    int tag, length;
+    t_subid subid;
+
+    if (ber_read_header(p, end, &tag, &length) != 0 || tag != BER_OID || length < 1)
+        return -1;
+
+    stop = *p + length;
+    name->length = 0;
+
+    while (*p < stop && name->length < AGENT_OID_MAX) {
+        for (subid = 0; *p < stop && (**p & 0x80); (*p)++)
+            subid = (subid << 7) | (**p & 0x7f);
+        if (*p == stop)
+            return -1;
+        subid = (subid << 7) | *(*p)++;
+
+        if (name->length == 0) {
+            name->name[0] = subid < 80 ? subid / 40 : 2;
+            name->name[1] = subid - name->name[0] * 40;
+            name->length = 2;
+        } else {
+            name->name[name->length++] = subid;
+        }
+    }
+
+    return *p == stop ? 0 : -1;
+}
+
+/*
+ * answer : build the response to a request
+ *
+ * return : size of the response, or 0 if the request is invalid
+ */
+
+static int answer(const unsigned char *req, int reqlen, unsigned char *resp, int msgsize)
+{
+    static unsigned char varbinds[AGENT_MSG_MAX], pdu[AGENT_MSG_MAX];
+    const unsigned char *p = req, *end = req + reqlen, *community;
+    t_oid names[AGENT_VARBINDS_MAX], name;
+    long version, reqid, nonrep, maxrep;
+    int tag, length, communitylen, pdutype, nvars = 0, size = 0, count, rep, column, index, varsize, room;
+    int errstat = 0, errindex = 0;
+    unsigned char buf[1024];
+
+    if (ber_read_header(&p, end, &tag, &length) != 0 || tag != BER_SEQUENCE ||
+        ber_read_integer(&p, end, &version) != 0 || (version != 0 && version != 1) ||
+        ber_read_header(&p, end, &tag, &communitylen) != 0 || tag != BER_OCTET_STR)
+        return 0;
+    community = p;
+    p += communitylen;
+
+    if (ber_read_header(&p, end, &pdutype, &length) != 0 ||
+        (pdutype != PDU_GET && pdutype != PDU_GETNEXT && (pdutype != PDU_GETBULK || version == 0)) ||
+        ber_read_integer(&p, end, &reqid) != 0 || ber_read_integer(&p, end, &nonrep) != 0 ||
+        ber_read_integer(&p, end, &maxrep) != 0 || ber_read_header(&p, end, &tag, &length) != 0 ||
+        tag != BER_SEQUENCE)
+        return 0;
+
+    while (p < end && nvars < AGENT_VARBINDS_MAX) {
+        if (ber_read_header(&p, end, &tag, &length) != 0 || tag != BER_SEQUENCE)
+            return 0;
+        if (ber_read_oid(&p, end, &names[nvars]) != 0 || ber_read_header(&p, end, &tag, &length) != 0)
+            return 0;
+        p += length;
+        nvars++;
+    }
+
+    stat_requests++;
+    stat_varbinds += nvars;
+
+    /* Room for the varbinds : message size less the headers */
+    room = msgsize - 32 - communitylen;
+
+    if (pdutype != PDU_GETBULK) {
+        nonrep = nvars;
+        maxrep = 0;
+    }
+    if (nonrep < 0)
+        nonrep = 0;
+    if (nonrep > nvars)
+        nonrep = nvars;
+    if (maxrep < 0)
+        maxrep = 0;
+
+    /* Non repeaters (all the varbinds of GET / GETNEXT) */
+    for (count = 0; count < nonrep && !errstat; count++) {
+        name = names[count];
+        if ((column = lookup(&name, pdutype != PDU_GET, &index)) >= 0) {
+            varsize = ber_varbind(buf, &name, 0, column, index);
+        } else if (version == 0) {
+            errstat = ERR_NOSUCHNAME;
+            errindex = count + 1;
+            break;
+        } else {
+            varsize = ber_varbind(buf, &names[count], pdutype == PDU_GET ? BER_NOSUCHINSTANCE : BER_ENDOFMIBVIEW,
+                                  0, 0);
+        }
+
+        if (size + varsize > room) {
+            errstat = ERR_TOOBIG;
+            break;
+        }
+        memcpy(varbinds + size, buf, varsize);
+        size += varsize;
+    }
+
+    /* Repeaters : the next rows of each, while the response has room */
+    for (rep = 0; rep < maxrep && !errstat && nvars > nonrep; rep++) {
+        for (count = nonrep; count < nvars; count++) {
+            if ((column = lookup(&names[count], 1, &index)) >= 0)
+                varsize = ber_varbind(buf, &names[count], 0, column, index);
+            else
+                varsize = ber_varbind(buf, &names[count], BER_ENDOFMIBVIEW, 0, 0);
+
+            if (size + varsize > room)
+                break;
+            memcpy(varbinds + size, buf, varsize);
+            size += varsize;
+        }
+        if (count < nvars) {
+            /* Truncated : an empty response is too big */
+            if (size == 0)
+                errstat = ERR_TOOBIG;
+            break;
+        }
+    }
+
+    /* Errors : the varbinds of the request */
+    if (errstat) {
+        for (count = 0, size = 0; count < nvars; count++)
+            size += ber_varbind(varbinds + size, &names[count], BER_NULL, 0, 0);
+    }
+
+    /* PDU : reqid, error-status, error-index, varbinds */
+    length = ber_integer(pdu, BER_INTEGER, reqid);
+    length += ber_integer(pdu + length, BER_INTEGER, errstat);
+    length += ber_integer(pdu + length, BER_INTEGER, errindex);
+    length += ber_header(pdu + length, BER_SEQUENCE, size);
+    memcpy(pdu + length, varbinds, size);
+    length += size;
+
+    /* Message : version, community, PDU */
+    size = ber_integer(buf, BER_INTEGER, version);
+    size += ber_header(buf + size, BER_OCTET_STR, communitylen);
+    memcpy(buf + size, community, communitylen);
+    size += communitylen;
+    size += ber_header(buf + size, PDU_RESPONSE, length);
+
+    count = ber_header(resp, BER_SEQUENCE, size + length);
+    memcpy(resp + count, buf, size);
+    memcpy(resp + count + size, pdu, length);
+
+    return count + size + length;
+}
+
+static void on_usr1(int sig)
+{
+    (void)sig;
+    dump_stats = 1;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "USAGE: bench_agent [-p PORT] [-s ROWS] [-r ROWS] [-c ROWS] [-m SIZE] [-S FILE]\n\n"
+            "  -p PORT\tUDP port on 127.0.0.1 (%d by default)\n"
+            "  -s ROWS\tRows of hrStorageTable (100), the first two are memory\n"
+            "  -r ROWS\tRows of hrSWRunTable and hrSWRunPerfTable (100)\n"
+            "  -c ROWS\tRows of hrProcessorTable (4)\n"
+            "  -m SIZE\tMax size of a response (%d), larger ones are tooBig or truncated\n"
+            "  -S FILE\tOn SIGUSR1, write the counters in FILE and reset them\n", AGENT_PORT, AGENT_MSG_SIZE);
+}
+
+int main(int argc, char *argv[])
+{
+    static unsigned char req[AGENT_MSG_MAX], resp[AGENT_MSG_MAX];
+    struct sockaddr_in addr, peer;
+    struct sigaction sa;
+    socklen_t peerlen;
+    const char *statsfile = NULL;
+    int opt, fd, port = AGENT_PORT, msgsize = AGENT_MSG_SIZE;
+    ssize_t n, len;
+    FILE *fp;
+
+    while ((opt = getopt(argc, argv, "hp:s:r:c:m:S:")) != -1) {
+        switch (opt) {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 's':
+            storage_rows = atoi(optarg);
+            break;
+        case 'r':
+            process_rows = atoi(optarg);
+            break;
+        case 'c':
+            cpu_rows = atoi(optarg);
+            break;
+        case 'm':
+            msgsize = atoi(optarg);
+            if (msgsize < 484 || msgsize > AGENT_MSG_MAX)
+                msgsize = AGENT_MSG_SIZE;
+            break;
+        case 'S':
+            statsfile = optarg;
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    gettimeofday(&started, NULL);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_usr1;
+    sigaction(SIGUSR1, &sa, NULL);      // no SA_RESTART : recvfrom returns
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "bench_agent: can't listen on 127.0.0.1:%d : %s\n", port, strerror(errno));
+        return 1;
+    }
+
+    for (;;) {
+        if (dump_stats) {
+            dump_stats = 0;
+            if (statsfile && (fp = fopen(statsfile, "w")) != NULL) {
+                fprintf(fp, "requests %lu varbinds %lu bytes_in %lu bytes_out %lu\n", stat_requests,
+                        stat_varbinds, stat_bytes_in, stat_bytes_out);
+                fclose(fp);
+            }
+            stat_requests = stat_varbinds = stat_bytes_in = stat_bytes_out = 0;
+        }
+
+        peerlen = sizeof(peer);
+        if ((n = recvfrom(fd, req, sizeof(req), 0, (struct sockaddr *)&peer, &peerlen)) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        stat_bytes_in += n;
+
+        if ((len = answer(req, n, resp, msgsize)) > 0 &&
+            sendto(fd, resp, len, 0, (struct sockaddr *)&peer, peerlen) == len)
+            stat_bytes_out += len;
+    }
+
+    return 1;
+}
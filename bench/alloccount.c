@@ -0,0 +1,96 @@
+/*
+ *    alloccount . Allocations and peak memory of a program (LD_PRELOAD)
+ *
+ *    Copyright (C) 2006  Vincent GERARD v.ge@wanadoo.fr
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; see the file COPYING. If not, write to the
+ *    Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Counts the calls to malloc, calloc and realloc (glibc) of a program. At
+ * exit, "ALLOCS RSS_KB" (max resident set size) is appended to the file
+ * named by the environment variable ALLOCCOUNT_FILE :
+ *	LD_PRELOAD=liballoccount.so ALLOCCOUNT_FILE=/tmp/allocs check_snmp_disk ...
+ *
+ * The processes forked by the program (the checks of check_snmp, the hosts
+ * of a fan-out) end with _exit(), which doesn't run the destructors : it is
+ * wrapped too. They append "ALLOCS RSS_KB child", ALLOCS counting only the
+ * calls made after the fork, to be added to the line of their parent.
+ */
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long allocs = 0, allocs_forked = 0;
+static int forked = 0, reported = 0;
+
+void *malloc(size_t size)
+{
+    allocs++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    allocs++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    allocs++;
+    return __libc_realloc(ptr, size);
+}
+
+static void alloccount_child(void)
+{
+    forked = 1;
+    allocs_forked = allocs;
+}
+
+static void __attribute__((constructor)) alloccount_init(void)
+{
+    pthread_atfork(NULL, NULL, alloccount_child);
+}
+
+static void __attribute__((destructor)) alloccount_report(void)
+{
+    const char *file = getenv("ALLOCCOUNT_FILE");
+    unsigned long count = allocs - allocs_forked;
+    struct rusage usage;
+    FILE *fp;
+
+    if (reported || file == NULL || getrusage(RUSAGE_SELF, &usage) != 0 || (fp = fopen(file, "a")) == NULL)
+        return;
+    reported = 1;
+
+    fprintf(fp, forked ? "%lu %ld child\n" : "%lu %ld\n", count, usage.ru_maxrss);
+    fclose(fp);
+}
+
+void _exit(int status)
+{
+    alloccount_report();
+    syscall(SYS_exit_group, status);
+    for (;;);
+}
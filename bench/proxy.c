@@ -0,0 +1,390 @@
+/*
+ *    bench_proxy . UDP proxy degrading the link between the plugins and an agent
+ *
+ *    Copyright (C) 2006  Vincent GERARD v.ge@wanadoo.fr
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; see the file COPYING. If not, write to the
+ *    Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Listens on 127.0.0.1:PORT and forwards each datagram to the agent, and its
+ * answers back, through a link with (in each direction) :
+ *   - a delay, plus a jitter taken uniformly in [-jitter, +jitter],
+ *   - a loss rate,
+ *   - a reordering rate : these datagrams are sent at once, before the ones
+ *     being delayed (like netem),
+ *   - a max datagram size : larger ones are dropped (a fragment lost, or a
+ *     path MTU with no fragmentation).
+ * Each client gets its own socket to the agent, so several plugins can run
+ * together. Each run of a plugin is a new client (a new source port) : when
+ * PROXY_CLIENTS_MAX are known, the one idle for the longest time is replaced
+ * if idle for PROXY_IDLE_MS, else the datagram is refused. The counters are
+ * printed on stderr at exit (SIGINT, SIGTERM) : datagrams refused, and sent
+ * without their delay because the queue was full, skew the results.
+ *
+ * Example : agent on 127.0.0.1:161, 80ms RTT, 2% loss on each way
+ *	bench_proxy -p 16162 -a 127.0.0.1:161 -d 40 -j 10 -L 2 &
+ *	check_snmp_disk -H 127.0.0.1:16162 -C public -m d -w 90 -c 95
+ */
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PROXY_PORT 16162
+#define PROXY_MSG_MAX 65535
+#define PROXY_CLIENTS_MAX 256
+#define PROXY_QUEUE_MAX 1024
+#define PROXY_IDLE_MS 1000
+
+typedef struct client {
+    struct sockaddr_in addr;
+    int fd;                     // socket to the agent
+    long long last;             // ms, last datagram from the client
+} t_client;
+
+/* A datagram waiting for its delay */
+typedef struct datagram {
+    long long due;              // ms, CLOCK_MONOTONIC
+    int fd;
+    struct sockaddr_in to;
+    int length;
+    unsigned char *data;
+} t_datagram;
+
+static struct {
+    int delay, jitter, maxsize;
+    double loss, reorder;
+} impairment = { 0, 0, PROXY_MSG_MAX, 0.0, 0.0 };
+
+static t_client clients[PROXY_CLIENTS_MAX];
+static int nclients = 0;
+static t_datagram queue[PROXY_QUEUE_MAX];
+static int nqueue = 0;
+static volatile sig_atomic_t stop = 0;
+
+/* Counters : [0] client -> agent, [1] agent -> client */
+static unsigned long stat_forwarded[2], stat_lost[2], stat_toobig[2], stat_reordered[2], stat_undelayed[2];
+static unsigned long stat_refused, stat_evicted;
+
+static long long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static double random_unit(void)
+{
+    return rand() / (RAND_MAX + 1.0);
+}
+
+/*
+ * impair : send a datagram through the link
+ *
+ *	args : way = 0 to the agent, 1 to the client
+ */
+
+static void impair(int way, int fd, const struct sockaddr_in *to, const unsigned char *data, int length)
+{
+    t_datagram *d;
+    int delay;
+
+    if (length > impairment.maxsize) {
+        stat_toobig[way]++;
+        return;
+    }
+    if (random_unit() * 100 < impairment.loss) {
+        stat_lost[way]++;
+        return;
+    }
+
+    stat_forwarded[way]++;
+
+    delay = impairment.delay;
+    if (impairment.jitter > 0)
+        delay += rand() % (2 * impairment.jitter + 1) - impairment.jitter;
+    if (impairment.reorder > 0 && random_unit() * 100 < impairment.reorder) {
+        stat_reordered[way]++;
+        delay = 0;
+    }
+
+    if (delay > 0 && nqueue == PROXY_QUEUE_MAX)
+        stat_undelayed[way]++;
+    if (delay <= 0 || nqueue == PROXY_QUEUE_MAX) {
+        sendto(fd, data, length, 0, (const struct sockaddr *)to, sizeof(*to));
+        return;
+    }
+
+    d = &queue[nqueue++];
+    d->due = now_ms() + delay;
+    d->fd = fd;
+    d->to = *to;
+    d->length = length;
+    d->data = malloc(length);
+    memcpy(d->data, data, length);
+}
+
+/*
+ * flush : send the datagrams due
+ *
+ * return : ms before the next one is due, -1 if none is waiting
+ */
+
+static int flush(void)
+{
+    long long now = now_ms(), next = -1;
+    int count = 0;
+
+    while (count < nqueue) {
+        if (queue[count].due <= now) {
+            sendto(queue[count].fd, queue[count].data, queue[count].length, 0,
+                   (struct sockaddr *)&queue[count].to, sizeof(queue[count].to));
+            free(queue[count].data);
+            /* In the order they were queued : same delay, same order */
+            memmove(&queue[count], &queue[count + 1], (nqueue - count - 1) * sizeof(t_datagram));
+            nqueue--;
+            continue;
+        }
+        if (next < 0 || queue[count].due - now < next)
+            next = queue[count].due - now;
+        count++;
+    }
+
+    return (int)next;
+}
+
+/*
+ * client_evict : forget the client idle for the longest time, if it is idle
+ *		  for PROXY_IDLE_MS (its datagrams to the agent are dropped)
+ *
+ * return : its slot, or -1 if all the clients are active
+ */
+
+static int client_evict(void)
+{
+    long long now = now_ms();
+    int count, oldest = 0, kept;
+
+    for (count = 1; count < nclients; count++) {
+        if (clients[count].last < clients[oldest].last)
+            oldest = count;
+    }
+    if (now - clients[oldest].last < PROXY_IDLE_MS)
+        return -1;
+
+    for (count = 0, kept = 0; count < nqueue; count++) {
+        if (queue[count].fd == clients[oldest].fd)
+            free(queue[count].data);
+        else
+            queue[kept++] = queue[count];
+    }
+    nqueue = kept;
+
+    close(clients[oldest].fd);
+    clients[oldest].fd = -1;
+    memset(&clients[oldest].addr, 0, sizeof(clients[oldest].addr));
+    stat_evicted++;
+
+    return oldest;
+}
+
+/*
+ * client_fd : socket to the agent of a client (created the first time)
+ *
+ * return : socket, or -1 if too many clients
+ */
+
+static int client_fd(const struct sockaddr_in *addr, const struct sockaddr_in *agent)
+{
+    int count, fd, slot;
+
+    for (count = 0; count < nclients; count++) {
+        if (clients[count].addr.sin_port == addr->sin_port &&
+            clients[count].addr.sin_addr.s_addr == addr->sin_addr.s_addr) {
+            clients[count].last = now_ms();
+            return clients[count].fd;
+        }
+    }
+
+    slot = nclients < PROXY_CLIENTS_MAX ? nclients : client_evict();
+    if (slot < 0 || (fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        stat_refused++;
+        return -1;
+    }
+    if (connect(fd, (const struct sockaddr *)agent, sizeof(*agent)) != 0) {
+        close(fd);
+        stat_refused++;
+        return -1;
+    }
+
+    /* A slot freed by client_evict() is left unused if this fails : not a problem */
+    clients[slot].addr = *addr;
+    clients[slot].fd = fd;
+    clients[slot].last = now_ms();
+    if (slot == nclients)
+        nclients++;
+
+    return fd;
+}
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "USAGE: bench_proxy -a HOST:PORT [-p PORT] [-d MS] [-j MS] [-L PCT] [-r PCT] [-m SIZE] "
+            "[-S SEED]\n\n"
+            "  -a HOST:PORT\tAgent (IPv4 address)\n"
+            "  -p PORT\tUDP port on 127.0.0.1 for the plugins (%d by default)\n"
+            "  -d MS\t\tDelay of each way\n"
+            "  -j MS\t\tJitter : the delay varies by +/- MS\n"
+            "  -L PCT\tLoss rate of each way (float)\n"
+            "  -r PCT\tReordering rate : datagrams sent before the ones delayed\n"
+            "  -m SIZE\tMax size of a datagram, larger ones are dropped\n"
+            "  -S SEED\tSeed of the random draws (time by default)\n", PROXY_PORT);
+}
+
+int main(int argc, char *argv[])
+{
+    static unsigned char buf[PROXY_MSG_MAX];
+    struct pollfd fds[PROXY_CLIENTS_MAX + 1];
+    struct sockaddr_in addr, agent, from;
+    struct sigaction sa;
+    socklen_t fromlen;
+    char *colon;
+    int opt, listener, count, timeout, fd, npolled, port = PROXY_PORT, agent_set = 0;
+    unsigned int seed = time(NULL);
+    ssize_t n;
+
+    memset(&agent, 0, sizeof(agent));
+    agent.sin_family = AF_INET;
+
+    while ((opt = getopt(argc, argv, "ha:p:d:j:L:r:m:S:")) != -1) {
+        switch (opt) {
+        case 'a':
+            if ((colon = strrchr(optarg, ':')) == NULL) {
+                usage();
+                return 1;
+            }
+            *colon = '\0';
+            agent.sin_port = htons(atoi(colon + 1));
+            if (inet_pton(AF_INET, optarg, &agent.sin_addr) != 1) {
+                fprintf(stderr, "bench_proxy: %s is not an IPv4 address\n", optarg);
+                return 1;
+            }
+            agent_set = 1;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'd':
+            impairment.delay = atoi(optarg);
+            break;
+        case 'j':
+            impairment.jitter = atoi(optarg);
+            break;
+        case 'L':
+            impairment.loss = atof(optarg);
+            break;
+        case 'r':
+            impairment.reorder = atof(optarg);
+            break;
+        case 'm':
+            impairment.maxsize = atoi(optarg);
+            break;
+        case 'S':
+            seed = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    if (!agent_set) {
+        usage();
+        return 1;
+    }
+
+    srand(seed);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if ((listener = socket(AF_INET, SOCK_DGRAM, 0)) < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr))) {
+        fprintf(stderr, "bench_proxy: can't listen on 127.0.0.1:%d : %s\n", port, strerror(errno));
+        return 1;
+    }
+
+    while (!stop) {
+        timeout = flush();
+
+        fds[0].fd = listener;
+        fds[0].events = POLLIN;
+        for (count = 0; count < nclients; count++) {
+            fds[count + 1].fd = clients[count].fd;
+            fds[count + 1].events = POLLIN;
+        }
+        npolled = nclients;
+
+        if (poll(fds, npolled + 1, timeout) <= 0)
+            continue;
+
+        /* Client -> agent */
+        if (fds[0].revents & POLLIN) {
+            fromlen = sizeof(from);
+            if ((n = recvfrom(listener, buf, sizeof(buf), 0, (struct sockaddr *)&from, &fromlen)) > 0 &&
+                (fd = client_fd(&from, &agent)) >= 0)
+                impair(0, fd, &agent, buf, n);
+        }
+
+        /* Agent -> client, answered from the listening port (not a client added or replaced above) */
+        for (count = 0; count < npolled; count++) {
+            if ((fds[count + 1].revents & POLLIN) && fds[count + 1].fd == clients[count].fd &&
+                (n = recv(clients[count].fd, buf, sizeof(buf), 0)) > 0)
+                impair(1, listener, &clients[count].addr, buf, n);
+        }
+    }
+
+    fprintf(stderr, "bench_proxy: to agent %lu forwarded, %lu lost, %lu too big, %lu reordered, %lu undelayed "
+            "(queue full) ; to clients %lu forwarded, %lu lost, %lu too big, %lu reordered, %lu undelayed ; "
+            "clients %lu evicted (idle), %lu datagrams refused (too many clients)\n", stat_forwarded[0],
+            stat_lost[0], stat_toobig[0], stat_reordered[0], stat_undelayed[0], stat_forwarded[1], stat_lost[1],
+            stat_toobig[1], stat_reordered[1], stat_undelayed[1], stat_evicted, stat_refused);
+
+    return 0;
+}
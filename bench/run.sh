@@ -0,0 +1,152 @@
+#!/bin/sh
+#
+# run.sh . Cost of the Nagios snmp plugins on synthetic tables
+#
+# Starts bench_agent on loopback with tables of each size in ROWS
+# (hrStorageTable, hrSWRunTable / hrSWRunPerfTable, hrProcessorTable), runs
+# each plugin RUNS times against it, and writes one line per plugin and size
+# to OUT (tab separated, header first) :
+#   plugin rows runs wall_ms_median wall_ms_p95 wall_ms_max requests
+#   varbinds bytes_out bytes_in allocs rss_kb_max
+# requests, varbinds and bytes are per run, as counted by the agent (bytes_out
+# : sent by the plugin). allocs : malloc / calloc / realloc calls per run,
+# with the ones of the processes it forks (the checks of check_snmp).
+# rss_kb_max : the largest process.
+#
+# With IMPAIR set, the plugins go through bench_proxy, given these options :
+# delay, jitter, loss... (see bench_proxy -h). Retries are then counted in the
+# requests, and the timeouts in the tail of the wall time :
+#	IMPAIR="-d 40 -j 10 -L 2" ROWS=10000 RUNS=100 bench/run.sh build
+#
+# Usage : bench/run.sh [BUILD_DIR]
+#	  environment : ROWS ("10 100 1000 10000 50000"), RUNS (10),
+#			PORT (16161), VERSION (2c), OUT (bench-results.tsv),
+#			AGENT (BUILD_DIR/bench_agent),
+#			ALLOCCOUNT (BUILD_DIR/liballoccount.so),
+#			IMPAIR (none), PROXY (BUILD_DIR/bench_proxy)
+#
+# Needs date +%N. "make benchmark" builds and runs everything.
+
+BUILD=${1:-build}
+ROWS=${ROWS:-"10 100 1000 10000 50000"}
+RUNS=${RUNS:-10}
+PORT=${PORT:-16161}
+VERSION=${VERSION:-2c}
+OUT=${OUT:-bench-results.tsv}
+AGENT=${AGENT:-$BUILD/bench_agent}
+ALLOCCOUNT=${ALLOCCOUNT:-$BUILD/liballoccount.so}
+PROXY=${PROXY:-$BUILD/bench_proxy}
+
+for file in "$AGENT" "$ALLOCCOUNT"; do
+    if [ ! -f "$file" ]; then
+        echo "$file not found (make bench_agent alloccount)" >&2
+        exit 1
+    fi
+done
+if [ -n "$IMPAIR" ] && [ ! -f "$PROXY" ]; then
+    echo "$PROXY not found (make bench_proxy)" >&2
+    exit 1
+fi
+
+TMP=$(mktemp -d) || exit 1
+AGENT_PID=
+PROXY_PID=
+
+# The plugins talk to the proxy, on the next port, if any
+TARGET=$PORT
+[ -n "$IMPAIR" ] && TARGET=$((PORT + 1))
+
+cleanup() {
+    [ -n "$AGENT_PID" ] && kill "$AGENT_PID" 2>/dev/null
+    [ -n "$PROXY_PID" ] && kill "$PROXY_PID" 2>/dev/null
+    rm -rf "$TMP"
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+# The plugins learn the GETBULK size between runs : not from another size
+CHECK_SNMP_STATEDIR=$TMP/state
+export CHECK_SNMP_STATEDIR
+
+# agent_stats : counters of the agent since the last call
+agent_stats() {
+    rm -f "$TMP/agent"
+    kill -USR1 "$AGENT_PID"
+    i=0
+    while [ ! -s "$TMP/agent" ] && [ $i -lt 50 ]; do
+        sleep 0.1
+        i=$((i + 1))
+    done
+    cat "$TMP/agent" 2>/dev/null
+}
+
+# bench NAME ARGS... : one result line for the current size
+bench() {
+    name=$1
+    shift
+    if [ ! -x "$BUILD/$name" ]; then
+        echo "$BUILD/$name not found" >&2
+        return
+    fi
+
+    rm -rf "$TMP/state" "$TMP/allocs" "$TMP/wall"
+    agent_stats >/dev/null
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+        start=$(date +%s%N)
+        LD_PRELOAD=$ALLOCCOUNT ALLOCCOUNT_FILE=$TMP/allocs \
+            "$BUILD/$name" -H "127.0.0.1:$TARGET" -C public -s "$VERSION" "$@" >/dev/null 2>&1
+        end=$(date +%s%N)
+        echo $(((end - start) / 1000)) >>"$TMP/wall"
+        i=$((i + 1))
+    done
+
+    stats=$(agent_stats)
+    sort -n "$TMP/wall" | awk -v name="$name" -v rows="$rows" -v runs="$RUNS" -v stats="$stats" \
+        -v allocs="$TMP/allocs" '
+        { wall[NR] = $1 }
+        END {
+            split(stats, s, " ")
+            while ((getline line < allocs) > 0) {
+                split(line, a, " ")
+                nallocs += a[1]
+                if (a[2] > rss) rss = a[2]
+                if (a[3] != "child") nruns++
+            }
+            p95 = int(NR * 0.95 + 0.5)
+            if (p95 < 1) p95 = 1
+            printf "%s\t%d\t%d\t%.2f\t%.2f\t%.2f\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\t%d\n", name, rows, runs,
+                wall[int((NR + 1) / 2)] / 1000, wall[p95] / 1000, wall[NR] / 1000, s[2] / runs,
+                s[4] / runs, s[6] / runs, s[8] / runs, nruns ? nallocs / nruns : 0, rss
+        }'
+}
+
+printf "plugin\trows\truns\twall_ms_median\twall_ms_p95\twall_ms_max\trequests\tvarbinds\tbytes_out\tbytes_in\tallocs\trss_kb_max\n" \
+    >"$OUT"
+
+for rows in $ROWS; do
+    "$AGENT" -p "$PORT" -s "$rows" -r "$rows" -c "$rows" -S "$TMP/agent" &
+    AGENT_PID=$!
+    if [ -n "$IMPAIR" ]; then
+        "$PROXY" -p "$TARGET" -a "127.0.0.1:$PORT" $IMPAIR &
+        PROXY_PID=$!
+    fi
+    sleep 0.2
+
+    {
+        bench check_snmp_disk -m d -w 90 -c 95
+        bench check_snmp_process -m proc1 -w 1000000 -c 1000000
+        bench check_snmp_load -m W -w 90 -c 95
+        bench check_snmp_load -m L -w 10,8,5 -c 20,15,10
+        bench check_snmp disk -m d -w 90 -c 95 : process -m proc1 -w 1000000 -c 1000000 : load -m W -w 90 -c 95
+    } | tee -a "$OUT"
+
+    kill "$AGENT_PID"
+    wait "$AGENT_PID" 2>/dev/null
+    AGENT_PID=
+    if [ -n "$PROXY_PID" ]; then
+        kill "$PROXY_PID"
+        wait "$PROXY_PID" 2>/dev/null
+        PROXY_PID=
+    fi
+done
@@ -0,0 +1,58 @@
+#!/bin/sh
+#
+# startup.sh . Startup cost of the Nagios snmp plugins
+#
+# Runs each plugin RUNS times against HOST and prints, for the fast start
+# (default) and the full start (-v : MIBs read), the median
+# wall time from exec to exit and the max resident set size.
+#
+# Usage : bench/startup.sh [BUILD_DIR]
+#	  environment : HOST (127.0.0.1), COMMUNITY (public), RUNS (20),
+#			TIME (/usr/bin/time)
+#
+# Needs an SNMP agent on HOST, GNU time (/usr/bin/time) and date +%N.
+
+BUILD=${1:-build}
+HOST=${HOST:-127.0.0.1}
+COMMUNITY=${COMMUNITY:-public}
+RUNS=${RUNS:-20}
+TIME=${TIME:-/usr/bin/time}
+
+if [ ! -x "$TIME" ]; then
+    echo "GNU time ($TIME) is needed" >&2
+    exit 1
+fi
+
+# run PLUGIN ARGS... : "wall_ms rss_kb" of one run
+run() {
+    start=$(date +%s%N)
+    rss=$("$TIME" -f %M "$@" 2>&1 >/dev/null | tail -1)
+    end=$(date +%s%N)
+    echo "$(((end - start) / 1000)) $rss"
+}
+
+# bench NAME ARGS... : one result line per start mode
+bench() {
+    name=$1
+    shift
+    if [ ! -x "$BUILD/$name" ]; then
+        echo "$BUILD/$name not found" >&2
+        return
+    fi
+    for mode in fast full; do
+        verbose=
+        [ $mode = full ] && verbose=-v
+        i=0
+        while [ $i -lt "$RUNS" ]; do
+            run "$BUILD/$name" -H "$HOST" -C "$COMMUNITY" -s 2c $verbose "$@"
+            i=$((i + 1))
+        done | sort -n | awk -v name="$name" -v mode=$mode '
+            { wall[NR] = $1; if ($2 > rss) rss = $2 }
+            END { printf "%-20s %-5s %10.2f %10d\n", name, mode, wall[int((NR + 1) / 2)] / 1000, rss }'
+    done
+}
+
+printf "%-20s %-5s %10s %10s\n" PLUGIN START WALL_MS RSS_KB
+bench check_snmp_disk -m d -w 90 -c 95
+bench check_snmp_process -m init -w 10 -c 20
+bench check_snmp_load -m L -w 10,8,5 -c 20,15,10
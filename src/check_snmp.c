@@ -0,0 +1,561 @@
+/*
+	check_snmp . Run several Nagios snmp checks of a host over one session
+
+	Copyright (C) 2006  Vincent GERARD v.ge@wanadoo.fr
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; see the file COPYING. If not, write to the
+	Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <net-snmp/net-snmp-config.h>
+#include <net-snmp/net-snmp-includes.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <time.h>
+
+#include "snmp-common.h"
+#include "check_snmpd.h"
+
+/* Max number of checks of a run */
+#define CHECKS_MAX 16
+
+/* The checks, and the subtrees they walk (prefetched together) */
+static const oid hrStorageEntry_mib[] = { 1, 3, 6, 1, 2, 1, 25, 2, 3, 1 };
+static const oid hrSWRunName_mib[] = { 1, 3, 6, 1, 2, 1, 25, 4, 2, 1, 2 };
+static const oid hrSWRunPerfEntry_mib[] = { 1, 3, 6, 1, 2, 1, 25, 5, 1, 1 };
+static const oid hrProcessorLoad_mib[] = { 1, 3, 6, 1, 2, 1, 25, 3, 3, 1, 2 };
+static const oid laLoad_mib[] = { 1, 3, 6, 1, 4, 1, 2021, 10, 1, 3 };
+static const oid laLoadInt_mib[] = { 1, 3, 6, 1, 4, 1, 2021, 10, 1, 5 };
+
+static const struct {
+    const char *name;
+    const char *plugin;
+    int (*main)(int argc, char *argv[]);
+    const char *options;
+} plugins[] = {
+    { "disk", "check_snmp_disk", check_snmp_disk_main, DISK_OPTIONS },
+    { "process", "check_snmp_process", check_snmp_process_main, PROCESS_OPTIONS },
+    { "load", "check_snmp_load", check_snmp_load_main, LOAD_OPTIONS },
+    { NULL, NULL, NULL, NULL }
+};
+
+typedef struct check {
+    int plugin;                 // index in plugins
+    const char *service;        // name in the output
+    char **argv;                // arguments of the plugin
+    int argc;
+    int code;
+    char *output;
+} t_check;
+
+static const char *status_name[] = { "OK", "WARNING", "CRITICAL", "UNKNOWN" };
+
+static int verbose = 0;
+
+static void usage(void);
+static int parseChecks(int argc, char *argv[], char **common, int ncommon, t_check * checks);
+static int addRoots(const t_check * check, oid ** roots, size_t * rootlens, int nroots);
+static void runCheck(t_check * check);
+static void printCombined(t_check * checks, int nchecks, int worst);
+static void printPassive(const char *host, t_check * checks, int nchecks);
+
+static void usage(void)
+{
+    fprintf(stderr, "USAGE: check_snmp -H HOST -C COMMUNITY [-n] CHECK [ARGS] [: CHECK [ARGS]]...\n\n");
+    fprintf(stderr,
+            " Run several checks of a host over one SNMP session. The objects walked\n"
+            " by the checks are fetched together first, in shared GETBULK requests.\n\n"
+            " CHECK = disk, process or load (or SERVICE=CHECK to name it in the output)\n"
+            " ARGS = the options of check_snmp_disk, check_snmp_process or\n"
+            "        check_snmp_load, without the SNMP options\n\n"
+            " Options :\n"
+            "  -H HOST\tHostname/IP to query\n"
+            "  -C COMMUNITY\tSNMP community name\n"
+            "  SNMP v3:\n"
+            "     -u Username\n"
+            "     -p Password\n"
+            "     -k Authentication Protocol [MD5|SHA|SHA-224|SHA-256|SHA-384|SHA-512]\n"
+            "     -x Protocol   Privacy protocol [DES|AES]\n"
+            "     -X Passphrase Privacy protocol pass phrase\n"
+            "  -s VERSION\tSNMP VERSION=[1|2c|3]\n"
+            "  -t INTEGER\tMax timeout in seconds : the timeout follows the round trip times of the host\n"
+            "  -n \t\tOne passive check result per check (Nagios external command)\n"
+            "\t\t instead of one result for all the checks\n"
+            "  -S stderr|perf\tCost of the session and of the prefetch : requests, retries, bytes,\n"
+            "\t\t\t time of each phase, on stderr or as perfdata (a check may have its own -S)\n"
+            "  -v \t\tVerbose output (reads the MIB files)\n"
+            "  -h -?\t\tPrint this help\n" "  -V \t\tPrint Version\n\n"
+            " Example :\n"
+            "  check_snmp -H 10.0.0.1 -C public -s 2c disk -m d -w 90 -c 95 : load -m L -w 4,3,2 -c 8,6,4\n");
+}
+
+/*
+ * main function : -> parse command line args
+ *		   -> open the SNMP session, prefetch the subtrees
+ *		   -> run the checks, print their results
+ */
+
+int main(int argc, char *argv[])
+{
+    netsnmp_session session, *ss;
+    snmpv3_args_t v3_args;
+    t_check checks[CHECKS_MAX];
+    oid *roots[PREFETCH_ROOTS_MAX];
+    size_t rootlens[PREFETCH_ROOTS_MAX];
+    char *common[32], optnames[32][3], *hostname = NULL, *community = NULL;
+    int opt, ncommon = 0, nchecks, nroots = 0, count, passive = 0, timeout = 0;
+    int version = SNMP_VERSION_1, worst = OK;
+
+    init_v3_args(&v3_args);
+    stats_start();
+
+    if (argc == 1) {
+        usage();
+        return UNKNOWN;
+    }
+
+    /* Options up to the first check : the session, given to each check too */
+    while ((opt = getopt(argc, argv, "+?hVvnt:C:H:s:u:p:k:x:X:S:")) != -1) {
+        switch (opt) {
+        case '?':
+        case 'h':
+            usage();
+            exit(UNKNOWN);
+
+        case 'V':
+            print_version();
+            exit(UNKNOWN);
+
+        case 'n':
+            passive = 1;
+            continue;
+
+        case 'S':
+            /* Cost of the session and of the prefetch, not given to the checks */
+            if (stats_mode(optarg) < 0) {
+                printf("Statistics (%s) must be stderr or perf\n", optarg);
+                exit(UNKNOWN);
+            }
+            stats_set_mode(stats_mode(optarg));
+            continue;
+
+        case 'v':
+            verbose = 1;
+            break;
+
+        case 't':
+            if (!is_integer(optarg)) {
+                printf("Timeout interval (%s)must be integer!\n", optarg);
+                exit(UNKNOWN);
+            }
+            timeout = atoi(optarg);
+            break;
+
+        case 'C':
+            community = optarg;
+            break;
+
+        case 'H':
+            hostname = optarg;
+            break;
+
+        case 's':
+            if (strcmp(optarg, "2c") == 0) {
+                version = SNMP_VERSION_2c;
+            } else if (strcmp(optarg, "1") == 0) {
+                version = SNMP_VERSION_1;
+            } else if (strcmp(optarg, "3") == 0) {
+                version = SNMP_VERSION_3;
+            } else {
+                printf("Sorry, only SNMP vers. 1, 2c, 3 are supported at this time\n");
+                exit(UNKNOWN);
+            }
+            break;
+
+        case 'u':
+        case 'p':
+        case 'k':
+        case 'x':
+        case 'X':
+            snmpv3_parseargs(verbose, opt, optarg, &v3_args);
+            break;
+        }
+
+        /* Same option for the checks */
+        if (ncommon + 2 > (int)(sizeof(common) / sizeof(char *))) {
+            printf("Too many options\n");
+            exit(UNKNOWN);
+        }
+        snprintf(optnames[ncommon], sizeof(optnames[ncommon]), "-%c", opt);
+        common[ncommon] = optnames[ncommon];
+        ncommon++;
+        if (opt != 'v')
+            common[ncommon++] = optarg;
+    }
+
+    if (hostname == NULL || *hostname == '@' || !strcmp(hostname, "-") || strchr(hostname, ',')) {
+        printf("check_snmp checks one host (-H HOST)\n");
+        exit(UNKNOWN);
+    }
+
+    if (version != SNMP_VERSION_3 && !community) {
+        printf("Both Community and Hostname must be set for SNMP v2\n");
+        exit(UNKNOWN);
+    }
+
+    if ((nchecks = parseChecks(argc - optind, argv + optind, common, ncommon, checks)) <= 0)
+        exit(UNKNOWN);
+
+    snmp_sess_init(&session);
+
+    snmp_startup("check_snmp", verbose);
+
+    session.version = version;
+    session.peername = hostname;
+    if (version != SNMP_VERSION_3) {
+        session.community = (unsigned char *)community;
+        session.community_len = strlen(community);
+    } else {
+        stats_phase("keys");
+        snmpv3_set_session(&session, &v3_args);
+    }
+
+    if (timeout)
+        session.timeout = timeout * 1000000L;
+
+    SOCK_STARTUP;
+
+    snmpv3_load_keys(&session);
+
+    stats_phase("open");
+    if ((ss = snmp_open(&session)) == NULL) {
+        snmp_sess_perror("check_snmp", &session);
+        SOCK_CLEANUP;
+        exit(UNKNOWN);
+    }
+
+    stats_session(ss);
+    rtt_apply(ss, verbose);
+    rtt_share();
+    snmp_share_session(ss);
+
+    /* The subtrees of all the checks, in shared requests */
+    for (count = 0; count < nchecks; count++)
+        nroots = addRoots(&checks[count], roots, rootlens, nroots);
+
+    stats_phase("prefetch");
+    if (nroots > 0 && snmp_prefetch(ss, roots, rootlens, nroots) != 0 && verbose)
+        printf("check_snmp: prefetch failed, the checks walk on their own\n");
+
+    stats_phase("checks");
+    for (count = 0; count < nchecks; count++) {
+        runCheck(&checks[count]);
+        worst = snmp_worst(worst, checks[count].code);
+    }
+
+    stats_phase("close");
+    prefetch_free();
+    snmp_share_session(NULL);
+
+    rtt_save();
+    snmpv3_save_keys(&session, ss, worst == UNKNOWN);
+    snmp_close(ss);
+
+    SOCK_CLEANUP;
+
+    stats_phase("output");
+    if (passive)
+        printPassive(hostname, checks, nchecks);
+    else
+        printCombined(checks, nchecks, worst);
+
+    /* Not in the command file of Nagios */
+    if (!passive)
+        stats_print();
+
+    for (count = 0; count < nchecks; count++) {
+        free(checks[count].argv);
+        free(checks[count].output);
+    }
+
+    free_v3_args(&v3_args);
+
+    return worst;
+}
+
+/*
+ * parseChecks : split the arguments after the options in checks
+ *		 (CHECK ARGS : CHECK ARGS ...)
+ *
+ *	args : argc / argv = the arguments, common / ncommon = SNMP options
+ *	       put before the arguments of each check, checks = result
+ *
+ * return : number of checks, or -1 on error
+ */
+
+int parseChecks(int argc, char *argv[], char **common, int ncommon, t_check *checks)
+{
+    t_check *check;
+    char *name;
+    int count, nchecks = 0, first;
+
+    for (first = 0; first < argc; first = count + 1) {
+        for (count = first; count < argc && strcmp(argv[count], ":"); count++);
+
+        if (count == first) {
+            printf("Empty check\n");
+            return -1;
+        }
+
+        if (nchecks == CHECKS_MAX) {
+            printf("check_snmp runs at most %d checks\n", CHECKS_MAX);
+            return -1;
+        }
+
+        check = &checks[nchecks];
+        memset(check, 0, sizeof(t_check));
+        check->service = argv[first];
+        name = strchr(argv[first], '=') ? strchr(argv[first], '=') + 1 : argv[first];
+
+        for (check->plugin = 0; plugins[check->plugin].name; check->plugin++) {
+            if (!strcmp(name, plugins[check->plugin].name))
+                break;
+        }
+        if (plugins[check->plugin].name == NULL) {
+            printf("Unknown check %s (disk, process or load)\n", name);
+            return -1;
+        }
+
+        if (name != argv[first])
+            *(name - 1) = '\0';
+
+        /* plugin SNMP_OPTIONS ARGS */
+        check->argv = malloc((2 + ncommon + count - first) * sizeof(char *));
+        check->argv[check->argc++] = (char *)plugins[check->plugin].plugin;
+        memcpy(check->argv + check->argc, common, ncommon * sizeof(char *));
+        check->argc += ncommon;
+        memcpy(check->argv + check->argc, argv + first + 1, (count - first - 1) * sizeof(char *));
+        check->argc += count - first - 1;
+        check->argv[check->argc] = NULL;
+
+        nchecks++;
+    }
+
+    if (nchecks == 0)
+        usage();
+
+    return nchecks;
+}
+
+/*
+ * addRoots : add the subtrees walked by a check (once each)
+ *
+ * Checks using their own cache (-I) don't walk : nothing to prefetch.
+ * The arguments are parsed like the plugin does (-m L, -mL, -vmL...).
+ *
+ * return : new number of subtrees
+ */
+
+int addRoots(const t_check *check, oid **roots, size_t *rootlens, int nroots)
+{
+    const oid *add[2];
+    size_t addlens[2];
+    char **args;
+    int count, root, opt, nadd = 0, laload = 0, cached = 0;
+
+    /* A copy : getopt may reorder it */
+    if ((args = malloc((check->argc + 1) * sizeof(char *))) == NULL)
+        return nroots;
+    memcpy(args, check->argv, (check->argc + 1) * sizeof(char *));
+
+    opterr = 0;
+    optind = 1;
+    while ((opt = getopt(check->argc, args, plugins[check->plugin].options)) != -1) {
+        if (opt == 'I')
+            cached = 1;
+        else if (opt == 'm')
+            laload = !strcmp(optarg, "L");
+    }
+    optind = 1;
+    opterr = 1;
+    free(args);
+
+    if (cached)
+        return nroots;
+
+    if (!strcmp(plugins[check->plugin].name, "disk")) {
+        add[nadd] = hrStorageEntry_mib;
+        addlens[nadd++] = sizeof(hrStorageEntry_mib) / sizeof(oid);
+    } else if (!strcmp(plugins[check->plugin].name, "process")) {
+        add[nadd] = hrSWRunName_mib;
+        addlens[nadd++] = sizeof(hrSWRunName_mib) / sizeof(oid);
+        add[nadd] = hrSWRunPerfEntry_mib;
+        addlens[nadd++] = sizeof(hrSWRunPerfEntry_mib) / sizeof(oid);
+    } else if (laload) {
+        add[nadd] = laLoadInt_mib;
+        addlens[nadd++] = sizeof(laLoadInt_mib) / sizeof(oid);
+        add[nadd] = laLoad_mib;
+        addlens[nadd++] = sizeof(laLoad_mib) / sizeof(oid);
+    } else {
+        add[nadd] = hrProcessorLoad_mib;
+        addlens[nadd++] = sizeof(hrProcessorLoad_mib) / sizeof(oid);
+    }
+
+    for (count = 0; count < nadd && nroots < PREFETCH_ROOTS_MAX; count++) {
+        for (root = 0; root < nroots; root++) {
+            if (roots[root] == add[count])
+                break;
+        }
+        if (root == nroots) {
+            roots[nroots] = (oid *)add[count];
+            rootlens[nroots++] = addlens[count];
+        }
+    }
+
+    return nroots;
+}
+
+/*
+ * runCheck : run a check in a child process (it may exit() anywhere),
+ *	      keep its output and its exit code
+ *
+ *	The child uses the session and the prefetched subtrees of this
+ *	process. The checks run one after the other, on the same socket :
+ *	each check starts after the request IDs used by the previous one,
+ *	whose answers left on the socket are dropped (snmp_shared_wait).
+ */
+
+void runCheck(t_check *check)
+{
+    char buf[4096];
+    size_t len = 0, size = 0;
+    ssize_t n;
+    int pipefd[2], status;
+    pid_t pid;
+
+    check->code = UNKNOWN;
+    check->output = NULL;
+
+    fflush(stdout);
+
+    if (pipe(pipefd) != 0 || (pid = fork()) < 0) {
+        check->output = strdup("UNKNOWN: can't run the check\n");
+        return;
+    }
+
+    if (pid == 0) {
+        close(pipefd[0]);
+        dup2(pipefd[1], STDOUT_FILENO);
+        dup2(pipefd[1], STDERR_FILENO);
+        close(pipefd[1]);
+        optind = 1;
+        stats_set_mode(STATS_OFF);
+        snmp_shared_fork();
+        status = plugins[check->plugin].main(check->argc, check->argv);
+        fflush(stdout);
+        snmp_shared_exit();
+        _exit(status);
+    }
+
+    close(pipefd[1]);
+    for (;;) {
+        if ((n = read(pipefd[0], buf, sizeof(buf))) < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        if (len + n + 1 > size) {
+            size = (len + n + 1) * 2;
+            check->output = realloc(check->output, size);
+        }
+        memcpy(check->output + len, buf, n);
+        len += n;
+    }
+    close(pipefd[0]);
+
+    if (check->output == NULL)
+        check->output = strdup("");
+    else
+        check->output[len] = '\0';
+
+    if (waitpid(pid, &status, 0) == pid && WIFEXITED(status))
+        check->code = WEXITSTATUS(status);
+
+    snmp_shared_wait();
+}
+
+/*
+ * printCombined : one Nagios result for all the checks
+ *	first line : worst status, status of each check | perfdata of all
+ *	then the output of each check, prefixed by its name
+ */
+
+void printCombined(t_check *checks, int nchecks, int worst)
+{
+    char *line, *next, *perf;
+    int count, nperf = 0;
+
+    printf("%s :", status_name[worst >= OK && worst <= UNKNOWN ? worst : UNKNOWN]);
+    for (count = 0; count < nchecks; count++)
+        printf("%s %s %s", count ? "," : "", checks[count].service,
+               status_name[checks[count].code >= OK && checks[count].code <= UNKNOWN ? checks[count].code : UNKNOWN]);
+
+    /* Perfdata of the first line of each check */
+    for (count = 0; count < nchecks; count++) {
+        line = checks[count].output;
+        if ((perf = strchr(line, '|')) != NULL && (strchr(line, '\n') == NULL || perf < strchr(line, '\n'))) {
+            perf += strspn(perf + 1, " ") + 1;
+            printf("%s%.*s", nperf++ ? " " : " | ", (int)strcspn(perf, "\n"), perf);
+        }
+    }
+    printf("\n");
+
+    for (count = 0; count < nchecks; count++) {
+        for (line = checks[count].output; *line; line = next) {
+            next = line + strcspn(line, "\n");
+            if (line == checks[count].output) {
+                perf = memchr(line, '|', next - line);
+                printf("%s: %.*s\n", checks[count].service, (int)((perf ? perf : next) - line), line);
+            } else {
+                printf("%.*s\n", (int)(next - line), line);
+            }
+            if (*next)
+                next++;
+        }
+    }
+}
+
+/*
+ * printPassive : one Nagios passive check result per check
+ *	[TIME] PROCESS_SERVICE_CHECK_RESULT;HOST;SERVICE;CODE;OUTPUT
+ */
+
+void printPassive(const char *host, t_check *checks, int nchecks)
+{
+    char *p;
+    int count;
+
+    for (count = 0; count < nchecks; count++) {
+        printf("[%ld] PROCESS_SERVICE_CHECK_RESULT;%s;%s;%d;", (long)time(NULL), host, checks[count].service,
+               checks[count].code);
+        for (p = checks[count].output; *p; p++) {
+            if (*p == '\n') {
+                if (p[1] != '\0')
+                    fputs("\\n", stdout);
+            } else {
+                putchar(*p);
+            }
+        }
+        putchar('\n');
+    }
+}
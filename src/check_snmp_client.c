@@ -0,0 +1,147 @@
+/*
+	check_snmp_client . Run a Nagios snmp plugin through check_snmpd
+
+	Copyright (C) 2006  Vincent GERARD v.ge@wanadoo.fr
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; see the file COPYING. If not, write to the
+	Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Usage :
+ *	check_snmp_client [-S SOCKET] PLUGIN [ARGS...]
+ * or, installed (or linked) under the name of a plugin :
+ *	check_snmp_disk ARGS...
+ *
+ * The arguments are the ones of the plugin. The output and the exit code
+ * are the ones of the plugin run by check_snmpd.
+ */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "check_snmpd.h"
+
+#define UNKNOWN 3
+
+static int send_all(int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        if ((n = write(fd, buf, len)) < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct sockaddr_un addr;
+    const char *path = getenv(DAEMON_SOCKET_ENV);
+    const char *plugin;
+    char buf[4096], *end;
+    int fd, count, exitcode = -1;
+    size_t len;
+    ssize_t n;
+
+    /* Name of the plugin : ours, or the first argument */
+    plugin = strrchr(argv[0], '/') ? strrchr(argv[0], '/') + 1 : argv[0];
+
+    if (!strcmp(plugin, "check_snmp_client")) {
+        argv++;
+        argc--;
+        if (argc >= 2 && !strcmp(argv[0], "-S")) {
+            path = argv[1];
+            argv += 2;
+            argc -= 2;
+        }
+        if (argc < 1) {
+            fprintf(stderr, "USAGE: check_snmp_client [-S SOCKET] PLUGIN [ARGS...]\n");
+            return UNKNOWN;
+        }
+        plugin = argv[0];
+    }
+
+    if (path == NULL || *path == '\0')
+        path = DAEMON_SOCKET;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        printf("UNKNOWN: can't connect to check_snmpd on %s : %s\n", path, strerror(errno));
+        return UNKNOWN;
+    }
+
+    /* Request : plugin name, arguments, empty string */
+    if (send_all(fd, plugin, strlen(plugin) + 1) != 0) {
+        printf("UNKNOWN: can't send the request to check_snmpd\n");
+        return UNKNOWN;
+    }
+    for (count = 1; count < argc; count++) {
+        if (send_all(fd, argv[count], strlen(argv[count]) + 1) != 0) {
+            printf("UNKNOWN: can't send the request to check_snmpd\n");
+            return UNKNOWN;
+        }
+    }
+    if (send_all(fd, "", 1) != 0) {
+        printf("UNKNOWN: can't send the request to check_snmpd\n");
+        return UNKNOWN;
+    }
+
+    /* Response : output up to '\0', then the exit code */
+    len = 0;
+    while ((n = read(fd, buf + len, sizeof(buf) - len)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        len += n;
+
+        if ((end = memchr(buf, '\0', len)) != NULL) {
+            fwrite(buf, 1, end - buf, stdout);
+            if (end + 1 < buf + len) {
+                exitcode = (unsigned char)end[1];
+                break;
+            }
+            /* Exit code in the next read */
+            buf[0] = '\0';
+            len = 1;
+        } else {
+            fwrite(buf, 1, len, stdout);
+            len = 0;
+        }
+    }
+
+    close(fd);
+
+    if (exitcode < 0) {
+        printf("\nUNKNOWN: check_snmpd closed the connection\n");
+        return UNKNOWN;
+    }
+
+    return exitcode;
+}
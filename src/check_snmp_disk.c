@@ -20,6 +20,7 @@
 
 #include <net-snmp/net-snmp-config.h>
 #include <net-snmp/net-snmp-includes.h>
+#include <time.h>
 
 #include "snmp-common.h"
 #include "check_snmp_disk.h"
@@ -31,6 +32,7 @@ void usage(void)
     fprintf(stderr,
             " Required options :\n"
             "  -H HOST\tHostname/IP to query\n"
+            "\t\t or a list of hosts : HOST1,HOST2,... or @FILE or - (stdin), one result per line\n"
             "  SNMP v1/2c:\n"
             "     -C COMMUNITY\tSNMP community name\n"
             "  SNMP v3:\n"
@@ -49,11 +51,27 @@ void usage(void)
             "  -c xx\t\tCritical limit in percent\n"
             " Additionnals options :\n"
             "  -h -?\t\tPrint this help\n"
+            "  -v \t\tVerbose output (reads the MIB files)\n"
             "  -V \t\tPrint Version\n"
+            "  -P INTEGER\tWith a list of hosts : hosts checked at the same time (16 by default)\n"
+            "  -o FILE\tWith a list of hosts : write the result of each host in FILE\n"
+            "  -S stderr|perf\tCost of the check : requests, retries, bytes and time of each\n"
+            "\t\t\t phase, on stderr or as perfdata\n"
             "  -d \t\tProvide Performance data output\n"
             "  -s VERSION\tSNMP VERSION=[1|2c|3]\n"
-            "  -f STRING\tAdditional filter\n"
-            "\t\t\t Example : -f C: , -f /tmp \n"
+            "  -t INTEGER\tMax timeout in seconds : the timeout follows the round trip times of the host\n"
+            "  -W INTEGER\tMax number of outstanding requests (4 by default)\n"
+            "  -l \t\tWalk all the columns of the storage table together\n"
+            "\t\t\t (fewer requests with big tables and SNMP v1 agents)\n"
+            "  -I SECONDS\tKeep the storage entries found for SECONDS, only their size\n"
+            "\t\t\t and usage are asked until then (walk again if the agent restarts)\n"
+            "  -f PATTERN\tOnly check the entries with this description (glob, or ~REGEX),\n"
+            "\t\t\t may be repeated. Example : -f C: , -f /tmp , -f '/var*'\n"
+            "  -F PATTERN\tSkip the entries with this description, may be repeated\n"
+            "  -M MODE\tHow -f and -F match the descriptions (case ignored)\n"
+            "\t\t\t pattern = descriptions, globs and regexes (default)\n"
+            "\t\t\t exact = the whole description\n"
+            "\t\t\t prefix = the descriptions beginning with it (-f /var : /var/log)\n"
             "  -R NUMBER in percent\tRemove percentage from disks max capacity:\n\t\t\t-R 5 will simulate root reserved space\n");
 }
 
@@ -62,9 +80,9 @@ void usage(void)
  *  -> open the SNMP session
  */
 
-int main(int argc, char *argv[])
+int check_snmp_disk_main(int argc, char *argv[])
 {
-    netsnmp_session session, *ss;
+    netsnmp_session session;
     int opt;
     int exitcode = UNKNOWN;
     char *community = NULL;
@@ -73,8 +91,15 @@ int main(int argc, char *argv[])
     int timeout = 0;
     int version = SNMP_VERSION_1;
     snmpv3_args_t v3_args;
+    char **hosts = NULL;
+    char *statusfile = NULL;
+    int nhosts, parallel = FANOUT_DEFAULT;
+    unsigned int filterhash = 0;
+    char **filters = NULL, *filteropts = NULL, *filter;
+    int nfilters = 0, filtermode = MATCH_PATTERN, count;
 
     init_v3_args(&v3_args);
+    stats_start();
 
     /* Print the help if not arguments provided */
     if (argc == 1) {
@@ -86,7 +111,7 @@ int main(int argc, char *argv[])
      * get the common command line arguments with getopt
      */
 
-    while ((opt = getopt(argc, argv, "?hVdvt:w:c:m:C:H:s:f:R:u:p:k:x:X:")) != -1) {
+    while ((opt = getopt(argc, argv, DISK_OPTIONS)) != -1) {
         switch (opt) {
         case '?':
         case 'h':
@@ -103,6 +128,10 @@ int main(int argc, char *argv[])
             perfdata = 1;
             break;
 
+        case 'l':
+            lockstep = 1;
+            break;
+
         case 't':
             /* Change timeout */
             if (!is_integer(optarg)) {
@@ -157,6 +186,51 @@ int main(int argc, char *argv[])
             printf("%s: Verbose mode activated\n", bn);
             break;
 
+        case 'W':
+            /* Outstanding requests */
+            if (!is_integer(optarg) || atoi(optarg) < 1) {
+                printf("Window (%s) must be a positive integer!\n", optarg);
+                exit(UNKNOWN);
+            }
+
+            snmp_set_window(atoi(optarg));
+            break;
+
+        case 'P':
+            /* Hosts checked at the same time */
+            if (!is_integer(optarg) || atoi(optarg) < 1) {
+                printf("Parallel checks (%s) must be a positive integer!\n", optarg);
+                exit(UNKNOWN);
+            }
+
+            parallel = atoi(optarg);
+            break;
+
+        case 'S':
+            /* Cost of the check */
+            if (stats_mode(optarg) < 0) {
+                printf("Statistics (%s) must be stderr or perf\n", optarg);
+                exit(UNKNOWN);
+            }
+
+            stats_set_mode(stats_mode(optarg));
+            break;
+
+        case 'o':
+            /* Status file of a list of hosts */
+            statusfile = optarg;
+            break;
+
+        case 'I':
+            /* Max age of the index cache */
+            if (!is_integer(optarg) || atoi(optarg) < 1) {
+                printf("Cache age (%s) must be a positive integer!\n", optarg);
+                exit(UNKNOWN);
+            }
+
+            cache_age = atoi(optarg);
+            break;
+
         case 'u':
         case 'p':
         case 'k':
@@ -225,15 +299,44 @@ int main(int argc, char *argv[])
             break;
 
         case 'f':
-            if ((filteron = strlen(optarg)) < 20) {
-                strcpy(filter, optarg);
-            } else {
-                printf("Filter string can't exceed 20 char\n");
+        case 'F':
+            /* Descriptions kept (-f) or skipped (-F), added once -M is known */
+            filters = realloc(filters, (nfilters + 1) * sizeof(char *));
+            filteropts = realloc(filteropts, nfilters + 1);
+            filters[nfilters] = optarg;
+            filteropts[nfilters++] = opt;
+            break;
+
+        case 'M':
+            /* How the filters match */
+            if ((filtermode = matcher_mode(optarg)) < 0) {
+                printf("Match mode (%s) must be exact, prefix, truncated or pattern\n", optarg);
                 exit(UNKNOWN);
             }
             break;
         }
     }
+
+    for (count = 0; count < nfilters; count++) {
+        if (filteropts[count] == 'f' && include == NULL)
+            include = matcher_new(filtermode);
+        if (filteropts[count] == 'F' && exclude == NULL)
+            exclude = matcher_new(filtermode);
+
+        if (matcher_add(filteropts[count] == 'f' ? include : exclude, filters[count], NULL) != 0) {
+            printf("Invalid regular expression : %s\n", filters[count] + 1);
+            exit(UNKNOWN);
+        }
+
+        /* The entries cached depend on the filters */
+        filterhash = filterhash * 33 + filteropts[count];
+        for (filter = filters[count]; *filter; filter++)
+            filterhash = filterhash * 33 + (unsigned char)*filter;
+    }
+    filterhash = filterhash * 33 + filtermode;
+    free(filters);
+    free(filteropts);
+
     if ((warningmin == -1) || (criticalmin == -1)) {
         printf("Warning limit or/and Critical limit not set (-w /-c)\n");
         exit(UNKNOWN);
@@ -249,9 +352,12 @@ int main(int argc, char *argv[])
         exit(UNKNOWN);
     }
 
+    if (include || exclude)
+        snprintf(cache_kind, sizeof(cache_kind), "storage-%08x", filterhash);
+
     snmp_sess_init(&session);
 
-    init_snmp("check_disk");
+    snmp_startup("check_disk", verbose);
 
     session.version = version;
 
@@ -261,6 +367,7 @@ int main(int argc, char *argv[])
         session.community = (unsigned char *)community;
         session.community_len = strlen(community);
     } else {
+        stats_phase("keys");
         snmpv3_set_session(&session, &v3_args);
     }
 
@@ -270,29 +377,85 @@ int main(int argc, char *argv[])
 
     SOCK_STARTUP;
 
+    /* List of hosts : check them all, the results are printed one per line */
+    if (hostname && (nhosts = snmp_hostlist(hostname, &hosts)) != 0) {
+        if (nhosts < 0) {
+            printf("Can't read the list of hosts %s\n", hostname + 1);
+            SOCK_CLEANUP;
+            exit(UNKNOWN);
+        }
+
+        exitcode = snmp_fanout(hosts, nhosts, parallel, statusfile, checkHost, &session);
+
+        while (nhosts > 0)
+            free(hosts[--nhosts]);
+        free(hosts);
+    } else {
+        exitcode = checkHost(hostname, &session);
+    }
+
+    SOCK_CLEANUP;
+
+    free(hostname);
+    free(community);
+    free_v3_args(&v3_args);
+
+    return exitcode;
+}
+
+#ifndef SNMP_DAEMON
+int main(int argc, char *argv[])
+{
+    return check_snmp_disk_main(argc, argv);
+}
+#endif
+
+/*
+ * checkHost : open the SNMP session of a host, and check it
+ *
+ *	args : hostname, ctx = session prepared by main (version, community...)
+ *
+ *	return : Nagios code
+ */
+
+int checkHost(char *hostname, void *ctx)
+{
+    netsnmp_session *session = ctx, *ss;
+    int exitcode;
+
+    session->peername = hostname;
+    if (session->version == SNMP_VERSION_3)
+        stats_phase("keys");
+    snmpv3_load_keys(session);
+
     /*
      * open an SNMP session
      */
-    ss = snmp_open(&session);
+    stats_phase("open");
+    ss = snmp_open_session(session);
     if (ss == NULL) {
         /*
-         * diagnose snmp_open errors
+         * diagnose snmp_open errors with the input netsnmp_session pointer
          */
-        snmp_sess_perror("check_snmp_disk", &session);
-        SOCK_CLEANUP;
-        exit(UNKNOWN);
+        snmp_sess_perror("check_snmp_disk", session);
+        stats_print();
+        return UNKNOWN;
     }
-    /* launch the principal function with the session pointer */
+
+    /* Timeout and retries from the round trip times of the host */
+    rtt_apply(ss, verbose);
 
     exitcode = checkDisk(ss);
 
-    snmp_close(ss);
+    stats_phase("close");
+    if (!snmp_session_shared(ss)) {
+        rtt_save();
+        snmpv3_save_keys(session, ss, exitcode == UNKNOWN);
+    }
 
-    SOCK_CLEANUP;
+    snmp_close_session(ss);
 
-    free(hostname);
-    free(community);
-    free_v3_args(&v3_args);
+    stats_print();
 
     return exitcode;
 }
@@ -305,242 +468,355 @@ int main(int argc, char *argv[])
 
 int checkDisk(netsnmp_session *ss)
 {
-
-    netsnmp_pdu *response;
-    netsnmp_variable_list *vars;
     t_storage *storage = NULL;
-    oid name[MAX_OID_LEN];
-    size_t name_length;
-    oid root[MAX_OID_LEN];
-    size_t rootlen;
-    int count;
-    int running;
     int exitval = 0;
-
-    int fixed_id[100], net_id[100], mem_id = 0, virtual_id = 0;
-
-    int index_fixed = 0;
-    int index_net = 0;
     int index_storage = 0;
+    int filtered = include != NULL || exclude != NULL;
+    long uptime = -1;
+
+    if (cache_age > 0) {
+        /* Entries of the last walk, if they are still there */
+        stats_phase("cache");
+        if ((index_storage = readStorageCache(ss, &storage)) >= 0) {
+            stats_phase("output");
+            exitval = check_and_print(storage, index_storage);
+            free(storage);
+            return exitval;
+        }
+        index_storage = 0;
 
-    size_t typelen;
-
-    char *tmp;
-
-    unsigned char desc_uchar[50];
-    int allocunit, totalsize, used;
+        /* Before the walk : a restart during the walk means new indexes */
+        uptime = snmp_get_uptime(ss);
+    }
 
-    typelen = sizeof(FIXED_DISK);
+    stats_phase("walk");
+    if (lockstep) {
+        /* Complete rows in one walk, only up to hrStorageDescr if filtered */
+        if ((index_storage = walkStorageTable(ss, &storage, filtered ? 2 : STORAGE_WALK_COLUMNS)) < 0)
+            return UNKNOWN;
+    } else {
+        if ((index_storage = walkStorageTypes(ss, &storage)) < 0)
+            return UNKNOWN;
 
-    memmove(root, objid_mib, sizeof(objid_mib));
-    rootlen = sizeof(objid_mib) / sizeof(oid);
-    /*
-     * first object to start walk
-     */
-    memmove(name, root, rootlen * sizeof(oid));
-    name_length = rootlen;
+        /*
+         * Get descr, allocunit, size and used of all the entries,
+         * packed in as few requests as possible (only descr if filtered)
+         */
+        stats_phase("get");
+        if (snmp_get_batch(ss, index_storage * (filtered ? 1 : STORAGE_COLUMNS), STORAGE_VALUE_SIZE,
+                           filtered ? descr_oid : storage_oid, filtered ? descr_value : storage_value, storage) != 0) {
+            printf("SNMP Error: timeout\n");
+            free(storage);
+            return UNKNOWN;
+        }
+    }
 
-    running = 1;
+    if (filtered) {
+        /* Only the entries kept cost the requests of their size and usage */
+        index_storage = filterStorage(storage, index_storage);
 
-    while (running) {
+        if (verbose)
+            printf("%d entries skipped by the filters, %d kept\n", skipped, index_storage);
 
-        if ((response = getResponse(name, name_length, ss, SNMP_MSG_GETNEXT)) == NULL) {
+        stats_phase("get");
+        if (snmp_get_batch(ss, index_storage * (STORAGE_COLUMNS - 1), STORAGE_VALUE_SIZE,
+                           usage_oid, usage_value, storage) != 0) {
             printf("SNMP Error: timeout\n");
+            free(storage);
             return UNKNOWN;
         }
-        /* If no response error */
-        if (response->errstat == SNMP_ERR_NOERROR) {
-
-            for (vars = response->variables; vars; vars = vars->next_variable) {
-                if ((vars->name_length < rootlen) || (memcmp(root, vars->name, rootlen * sizeof(oid)) != 0)) {
-                    /*
-                     * not part of subtree
-                     */
-                    running = 0;
-                    continue;
-                }
-                if (verbose) {
-                    print_variable(vars->name, vars->name_length, vars);
-                }
+    }
 
-                if ((int)vars->name[10] == 2) {
-                    /* If var is an OID */
-                    if (vars->type == ASN_OBJECT_ID) {
-
-                        if ((check_disk == 1) && (!memcmp((vars->val).objid, FIXED_DISK, typelen))) {
-                            if (index_fixed < 100) {
-                                /* We put in the table fixed_id the last number of the OID
-                                 * which is the index of the fixed disk
-                                 * (and index_fixed is incremented to be equal with the
-                                 * number of disk parsed)
-                                 */
-                                fixed_id[index_fixed++] = (int)vars->name[11];
-                            } else {
-                                printf("snmp_check_disk doesn't support more than 100 fixed disks\n");
-                            }
-                        }
-
-                        else if ((check_ram == 1) && (!memcmp((vars->val).objid, RAM, typelen))) {
-                            /* Index of physical memory = the last number of the OID */
-                            mem_id = (int)vars->name[11];
-                        } else if ((check_vmem == 1) && (!memcmp((vars->val).objid, VIRTUAL_MEM, typelen))) {
-                            virtual_id = (int)vars->name[11];
-                        } else if ((check_net == 1) && (!memcmp((vars->val).objid, NETWORK_DISK, typelen))) {
-                            if (index_net < 100) {
-                                net_id[index_net++] = (int)vars->name[11];
-                            } else {
-                                printf("check_snmp_disk doesn't support more than 100 network disks\n");
-                            }
-                        }
-                    }
-                }
-                /*  exception check */
+    if (uptime >= 0) {
+        stats_phase("cache");
+        writeStorageCache(ss, storage, index_storage, uptime);
+    }
 
-                if ((vars->type != SNMP_ENDOFMIBVIEW) &&
-                    (vars->type != SNMP_NOSUCHOBJECT) && (vars->type != SNMP_NOSUCHINSTANCE)) {
+    stats_phase("output");
+    exitval = check_and_print(storage, index_storage);
 
-                    /* And we walk in the MIB :) */
+    free(storage);
 
-                    memmove((char *)name, (char *)vars->name, vars->name_length * sizeof(oid));
-                    name_length = vars->name_length;
-                } else
-                    /*
-                     *  exception , so stop
-                     */
-                    running = 0;
-            }
-        } else {
-            /*
-             * error in response, print
-             */
-            running = 0;
-            printf("Error in response");
-            return UNKNOWN;
-        }
+    return exitval;
+}
 
-        if (response)
-            snmp_free_pdu(response);
+/*
+ * walkStorageTypes : walk hrStorageType, one entry per row of a type
+ *		      selected by -m
+ *
+ *	args : ss = session, *storagep = where the t_storage table is returned
+ *	       (memory first, then disks), without their values
+ *
+ * return : number of entries, or -1 on error
+ */
+
+int walkStorageTypes(netsnmp_session *ss, t_storage **storagep)
+{
+    const oid *roots[] = { objid_mib };
+    size_t rootlens[] = { sizeof(objid_mib) / sizeof(oid) };
+    t_storage_walk walk;
+    t_storage *storage;
+    int index_storage;
+    int ret;
+
+    memset(&walk, 0, sizeof(walk));
+
+    if ((ret = snmp_walk(ss, roots, rootlens, 1, storageType, &walk)) != 0) {
+        printf(ret == WALK_TIMEOUT ? "SNMP Error: timeout\n" :
+               ret == WALK_VISIT ? "Out of memory\n" : "Error in response");
+        free(walk.storage);
+        return -1;
     }
 
-    /* MALLOC of initial storage to contain 6 structure
-     */
+    storage = walk.storage;
+    index_storage = walk.index_storage;
 
-    storage = malloc(6 * sizeof(t_storage));
+    /* Room kept for the memory entries */
+    if (storage == NULL && (storage = malloc(2 * sizeof(t_storage))) == NULL) {
+        printf("Out of memory\n");
+        return -1;
+    }
 
-    /*
-     * Physical memory
-     */
+    if (walk.mem_id != 0)
+        newStorageEntry(&storage[index_storage++], walk.mem_id, TYPE_MEM);
 
-    if (mem_id != 0) {
-        name[10] = 3;
-        name[11] = mem_id;
+    if (walk.virtual_id != 0)
+        newStorageEntry(&storage[index_storage++], walk.virtual_id, TYPE_VMEM);
 
-        memset(desc_uchar, '\0', 50);
+    /* Memory first, then the fixed disks, then the network disks */
+    if (index_storage > 1)
+        qsort(storage, index_storage, sizeof(t_storage), storage_cmp);
 
-        snmp_get_uchar(ss, name, 12, desc_uchar, 50);
+    *storagep = storage;
 
-        name[10] = 4;
-        allocunit = snmp_get_int(ss, name, 12);
+    return index_storage;
+}
 
-        name[10] = 5;
-        totalsize = snmp_get_int(ss, name, 12);
+/*
+ * storageType : hrStorageType of an entry (snmp_walk visitor)
+ */
 
-        name[10] = 6;
-        used = snmp_get_int(ss, name, 12);
+int storageType(int root, netsnmp_variable_list *vars, void *ctx)
+{
+    t_storage_walk *walk = ctx;
+    t_storage *storage;
+    int type;
 
-        storage = newStorageEntry(index_storage, storage, desc_uchar, 50, allocunit, totalsize, used, mem_id, TYPE_MEM);
-        index_storage++;
-    }
+    if (verbose)
+        print_variable(vars->name, vars->name_length, vars);
 
-    /*
-     * Virtual Memory
-     */
+    type = selectedType(vars);
 
-    if (virtual_id != 0) {
-        name[10] = 3;
-        name[11] = virtual_id;
+    if (type == TYPE_FIXED || type == TYPE_NET) {
+        /* One entry per disk, the index being the last number
+         * of the OID. The table doubles when full : no limit
+         * on the number of disks, few reallocs.
+         */
+        if (walk->index_storage + 2 >= walk->allocated) {
+            if ((storage = realloc(walk->storage, (walk->allocated ? walk->allocated * 2 : 16) *
+                                   sizeof(t_storage))) == NULL)
+                return -1;
+            walk->storage = storage;
+            walk->allocated = walk->allocated ? walk->allocated * 2 : 16;
+        }
+        newStorageEntry(&walk->storage[walk->index_storage++], (int)vars->name[11], type);
+    } else if (type == TYPE_MEM) {
+        /* Index of physical memory = the last number of the OID */
+        walk->mem_id = (int)vars->name[11];
+    } else if (type == TYPE_VMEM) {
+        walk->virtual_id = (int)vars->name[11];
+    }
 
-        snmp_get_uchar(ss, name, 12, desc_uchar, 50);
+    return 0;
+}
 
-        name[10] = 4;
-        allocunit = snmp_get_int(ss, name, 12);
+/*
+ * walkStorageTable : walk hrStorageType, Descr, AllocationUnits, Size and
+ *		      Used in lockstep, each request gets complete rows.
+ *		      Rows of a type not selected by -m are dropped at once.
+ *
+ *	args : ss = session, *storagep = where the t_storage table is returned
+ *	       (sorted like checkDisk does : memory first, then disks)
+ *	       ncolumns = number of columns walked, from hrStorageType
+ *
+ * return : number of entries, or -1 on error
+ */
 
-        name[10] = 5;
-        totalsize = snmp_get_int(ss, name, 12);
+int walkStorageTable(netsnmp_session *ss, t_storage **storagep, int ncolumns)
+{
+    netsnmp_pdu *response;
+    netsnmp_variable_list *vars, *row[STORAGE_WALK_COLUMNS];
+    int same[STORAGE_WALK_COLUMNS], aligned, incolumn, first;
+    oid names[STORAGE_WALK_COLUMNS][MAX_OID_LEN];
+    oid *pnames[STORAGE_WALK_COLUMNS];
+    size_t names_length[STORAGE_WALK_COLUMNS];
+    size_t entrylen = sizeof(objid_mib) / sizeof(oid) - 1;
+    t_storage *storage = NULL, *entry;
+    int count, type, running = 1;
+    int index_storage = 0, allocated = 0;
+    oid lastindex = 0, previndex, index;
+
+    /* Columns 2 (hrStorageType) to 6 (hrStorageUsed) of hrStorageEntry */
+    for (count = 0; count < ncolumns; count++) {
+        memmove(names[count], objid_mib, sizeof(objid_mib));
+        names[count][entrylen] = 2 + count;
+        names_length[count] = entrylen + 1;
+        pnames[count] = names[count];
+    }
 
-        name[10] = 6;
-        used = snmp_get_int(ss, name, 12);
+    while (running) {
+        if ((response = getNextColumns(pnames, names_length, ncolumns, objid_mib, entrylen, ss)) == NULL) {
+            printf("SNMP Error: timeout\n");
+            free(storage);
+            return -1;
+        }
 
-        storage = newStorageEntry(index_storage, storage, desc_uchar, 50, allocunit, totalsize, used, mem_id, TYPE_MEM);
-        index_storage++;
-    }
+        if (response->errstat != SNMP_ERR_NOERROR) {
+            printf("Error in response");
+            snmp_free_pdu(response);
+            free(storage);
+            return -1;
+        }
 
-    /*
-     * number of hard disks : index_fixed
-     * id table : fixed_id
-     * */
-    if (index_fixed != 0) {
+        previndex = lastindex;
 
-        for (count = 0; count < index_fixed; count++) {
+        /* One row = one varbind per column */
+        for (vars = response->variables, first = 1; vars && running; first = 0) {
+            for (count = 0; count < ncolumns && vars; count++, vars = vars->next_variable)
+                row[count] = vars;
 
-            name[10] = 3;
-            name[11] = fixed_id[count];
-            snmp_get_uchar(ss, name, 12, desc_uchar, 50);
+            /* End of hrStorageType column (or of the MIB) */
+            if (row[0]->name_length != entrylen + 2 ||
+                memcmp(objid_mib, row[0]->name, (entrylen + 1) * sizeof(oid)) != 0 ||
+                row[0]->type == SNMP_ENDOFMIBVIEW) {
+                running = 0;
+                break;
+            }
 
-            if ((tmp = strchr(desc_uchar, ' ')) != NULL) {
-                *tmp = '\0';
+            /* Row cut by the agent (message size, RFC 3416 4.2.3) : asked again */
+            if (count < ncolumns)
+                break;
+
+            /* Values of the same row only */
+            index = row[0]->name[entrylen + 1];
+            for (count = 1, aligned = 1; count < ncolumns; count++) {
+                incolumn = row[count]->name_length == entrylen + 2 && row[count]->name[entrylen] == (oid)(2 + count) &&
+                    !memcmp(objid_mib, row[count]->name, entrylen * sizeof(oid));
+                same[count] = incolumn && row[count]->name[entrylen + 1] == row[0]->name[entrylen + 1];
+                aligned &= same[count];
+                if (incolumn && row[count]->name[entrylen + 1] < index)
+                    index = row[count]->name[entrylen + 1];
             }
 
-            name[10] = 4;
-            allocunit = snmp_get_int(ss, name, 12);
-            name[10] = 5;
-            totalsize = snmp_get_int(ss, name, 12);
+            /*
+             * A hole in a column shifts the next rows of the response : they
+             * are asked again, from the last complete row. In the first row
+             * of a response, the hole is real (the agent has no such cell) :
+             * a row without type is skipped, another one is kept without the
+             * missing values, and the walk goes on after it.
+             */
+            if (!aligned && !first)
+                break;
 
-            name[10] = 6;
-            used = snmp_get_int(ss, name, 12);
+            if (index < row[0]->name[entrylen + 1]) {
+                lastindex = index;
+                break;
+            }
 
-            storage =
-                newStorageEntry(index_storage, storage, desc_uchar, 50, allocunit, totalsize, used, mem_id, TYPE_MEM);
-            index_storage++;
-        }
-    }
-    /*
-     * number of net disks : index_net
-     * id table : net_id
-     * */
+            lastindex = index;
 
-    if (index_net != 0) {
+            if (verbose) {
+                for (count = 0; count < ncolumns; count++)
+                    print_variable(row[count]->name, row[count]->name_length, row[count]);
+            }
 
-        for (count = 0; count < index_net; count++) {
+            if ((type = selectedType(row[0])) >= 0) {
+                if (index_storage == allocated) {
+                    if ((entry = realloc(storage, (allocated ? allocated * 2 : 8) * sizeof(t_storage))) == NULL) {
+                        printf("Out of memory\n");
+                        snmp_free_pdu(response);
+                        free(storage);
+                        return -1;
+                    }
+                    storage = entry;
+                    allocated = allocated ? allocated * 2 : 8;
+                }
 
-            name[10] = 3;
-            memset(desc_uchar, '\0', 50);
-            name[11] = net_id[count];
-            snmp_get_uchar(ss, name, 12, desc_uchar, 50);
+                entry = &storage[index_storage++];
+                newStorageEntry(entry, lastindex, type);
 
-            if ((tmp = strchr(desc_uchar, ' ')) != NULL) {
-                *tmp = '\0';
+                for (count = 1; count < ncolumns; count++) {
+                    if (same[count])
+                        storage_value(count - 1, row[count], entry);
+                }
             }
 
-            name[10] = 4;
-            allocunit = snmp_get_int(ss, name, 12);
-            name[10] = 5;
-            totalsize = snmp_get_int(ss, name, 12);
+            if (!aligned)
+                break;
+        }
+
+        snmp_free_pdu(response);
 
-            name[10] = 6;
-            used = snmp_get_int(ss, name, 12);
+        /* No progress (not even one row fits in a response) : the rest of
+         * the table can't be got, don't report on a part of it */
+        if (running && lastindex == previndex) {
+            printf("Error in response: no complete row of hrStorageTable\n");
+            free(storage);
+            return -1;
+        }
 
-            storage =
-                newStorageEntry(index_storage, storage, desc_uchar, 50, allocunit, totalsize, used, mem_id, TYPE_MEM);
-            index_storage++;
+        /* Next rows : all the columns restart after the last complete row */
+        for (count = 0; count < ncolumns; count++) {
+            names[count][entrylen + 1] = lastindex;
+            names_length[count] = entrylen + 2;
         }
     }
 
-    exitval = check_and_print(storage, index_storage);
+    if (index_storage > 1)
+        qsort(storage, index_storage, sizeof(t_storage), storage_cmp);
 
-    free(storage);
+    *storagep = storage;
 
-    return exitval;
+    return index_storage;
+}
+
+/*
+ * storage_cmp : qsort order of the entries (type, then index)
+ */
+
+int storage_cmp(const void *a, const void *b)
+{
+    const t_storage *sa = a, *sb = b;
+
+    if (sa->type != sb->type)
+        return sa->type - sb->type;
+
+    return (sa->index > sb->index) - (sa->index < sb->index);
+}
+
+/*
+ * selectedType : type of storage of a hrStorageType varbind
+ *
+ * return : TYPE_MEM, TYPE_VMEM, TYPE_FIXED, TYPE_NET, or -1 if this type
+ *	    isn't monitored (-m)
+ */
+
+int selectedType(netsnmp_variable_list *vars)
+{
+    /* If var is an OID */
+    if (vars->type != ASN_OBJECT_ID || vars->val_len != sizeof(FIXED_DISK))
+        return -1;
+
+    if (check_disk && !memcmp((vars->val).objid, FIXED_DISK, sizeof(FIXED_DISK)))
+        return TYPE_FIXED;
+    if (check_ram && !memcmp((vars->val).objid, RAM, sizeof(RAM)))
+        return TYPE_MEM;
+    if (check_vmem && !memcmp((vars->val).objid, VIRTUAL_MEM, sizeof(VIRTUAL_MEM)))
+        return TYPE_VMEM;
+    if (check_net && !memcmp((vars->val).objid, NETWORK_DISK, sizeof(NETWORK_DISK)))
+        return TYPE_NET;
+
+    return -1;
 }
 
 /*
@@ -569,12 +845,6 @@ int check_and_print(t_storage *storage, int storage_length)
         printf("DISKS ");
 
     for (count = 0; count < storage_length; count++, current_storage++) {
-        if (filteron != 0) {
-            if (strncmp(current_storage->descr, filter, filteron + 1) != 0) {
-                continue;
-            }
-        }
-
         /* Calc of the Total / Used Space , and value in percent
          * Double  because values can be bigger than INTEGER maximum
          */
@@ -639,36 +909,279 @@ int check_and_print(t_storage *storage, int storage_length)
     return exitstatus;
 }
 
-/* newStorageEntry : create a new structure in *storage and allocate memory
+/* newStorageEntry : initialize a structure of *storage, before the batched GET
  *
- * args 	   : -> index_storage : number of the structure
- * 		     ->*storage      : container
- * 	    	     -> and everything useful to fill t_storage struct
+ * args 	   : -> *entry : the structure
+ * 		     -> index_oid : index of the entry in hrStorageTable
+ * 	    	     -> type : TYPE_MEM, TYPE_VMEM, TYPE_FIXED or TYPE_NET
  *
- * return 	   : *storage (in case of the realloc change the memory zone)
+ */
+
+void newStorageEntry(t_storage *entry, int index_oid, int type)
+{
+    memset(entry, 0, sizeof(t_storage));
+    entry->index = index_oid;
+    entry->type = type;
+}
+
+/*
+ * storage_oid : OID of the item-th object to get (snmp_get_batch callback)
+ *		 STORAGE_COLUMNS objects per entry : hrStorageDescr,
+ *		 hrStorageAllocationUnits, hrStorageSize, hrStorageUsed
+ */
+
+size_t storage_oid(int item, oid *name, void *ctx)
+{
+    t_storage *storage = ctx;
+
+    memmove(name, objid_mib, sizeof(objid_mib));
+    name[10] = 3 + item % STORAGE_COLUMNS;
+    name[11] = storage[item / STORAGE_COLUMNS].index;
+
+    return 12;
+}
+
+/*
+ * storage_value : decode the item-th object in its t_storage
+ *		   (snmp_get_batch callback)
+ */
+
+void storage_value(int item, netsnmp_variable_list *vars, void *ctx)
+{
+    t_storage *entry = (t_storage *)ctx + item / STORAGE_COLUMNS;
+    size_t length;
+    char *tmp;
+
+    if (vars == NULL)
+        return;
+
+    switch (item % STORAGE_COLUMNS) {
+    case 0:
+        /* hrStorageDescr */
+        if (vars->type == ASN_OCTET_STR) {
+            length = vars->val_len < sizeof(entry->descr) ? vars->val_len : sizeof(entry->descr) - 1;
+            memcpy(entry->descr, vars->val.string, length);
+            entry->descr[length] = '\0';
+
+            /* Disks : "C:\ Label:xx  Serial Number xx" become "C:\" */
+            if ((entry->type == TYPE_FIXED || entry->type == TYPE_NET)
+                && (tmp = strchr((char *)entry->descr, ' ')) != NULL) {
+                *tmp = '\0';
+            }
+        }
+        break;
+
+    case 1:
+        if (vars->type == ASN_INTEGER)
+            entry->allocunit = *(vars->val).integer;
+        break;
+
+    case 2:
+        if (vars->type == ASN_INTEGER)
+            entry->totalsize = *(vars->val).integer;
+        break;
+
+    case 3:
+        if (vars->type == ASN_INTEGER)
+            entry->used = *(vars->val).integer;
+        break;
+    }
+}
+
+/*
+ * descr_oid / descr_value : hrStorageDescr of each entry only
+ *			     (snmp_get_batch callbacks, -f / -F)
+ */
+
+size_t descr_oid(int item, oid *name, void *ctx)
+{
+    return storage_oid(item * STORAGE_COLUMNS, name, ctx);
+}
+
+void descr_value(int item, netsnmp_variable_list *vars, void *ctx)
+{
+    storage_value(item * STORAGE_COLUMNS, vars, ctx);
+}
+
+/*
+ * usage_oid / usage_value : the columns after hrStorageDescr of each entry
+ *			     (snmp_get_batch callbacks, -f / -F)
+ */
+
+size_t usage_oid(int item, oid *name, void *ctx)
+{
+    return storage_oid(item / (STORAGE_COLUMNS - 1) * STORAGE_COLUMNS + 1 + item % (STORAGE_COLUMNS - 1), name, ctx);
+}
+
+void usage_value(int item, netsnmp_variable_list *vars, void *ctx)
+{
+    storage_value(item / (STORAGE_COLUMNS - 1) * STORAGE_COLUMNS + 1 + item % (STORAGE_COLUMNS - 1), vars, ctx);
+}
+
+/*
+ * filterStorage : drop the entries whose description isn't one of -f (if
+ *		   given) or is one of -F
  *
+ * return : number of entries kept, at the beginning of the table
  */
 
-t_storage *newStorageEntry(int index_storage, t_storage *storage, unsigned char *descr,
-                           size_t descr_length, int allocunit, int totalsize, int used, int index_oid, int type)
+int filterStorage(t_storage *storage, int index_storage)
 {
+    size_t length;
+    int count, kept = 0;
 
-    /* If more than 6 entry (initial malloc) and every 3 values
-     * Realloc of 3 more struct
-     */
+    for (count = 0; count < index_storage; count++) {
+        length = strlen((char *)storage[count].descr);
+
+        if ((include && !matcher_find(include, (char *)storage[count].descr, length, NULL, NULL)) ||
+            (exclude && matcher_find(exclude, (char *)storage[count].descr, length, NULL, NULL))) {
+            skipped++;
+            continue;
+        }
+
+        storage[kept++] = storage[count];
+    }
+
+    return kept;
+}
+
+/*
+ * readStorageCache : entries saved by the last walk (-I), with their size
+ *		      and usage of now
+ *
+ *	The cache is used if it was made for the same -m, is younger than -I
+ *	seconds, the agent didn't restart since (sysUpTime) and all its entries
+ *	still exist.
+ *
+ *	args : ss = session, *storagep = where the t_storage table is returned
+ *
+ * return : number of entries, or -1 if the table must be walked
+ */
 
-    if ((index_storage >= 6) && (index_storage % 3 == 0)) {
-        storage = realloc(storage, (index_storage + 3) * sizeof(t_storage));
+int readStorageCache(netsnmp_session *ss, t_storage **storagep)
+{
+    t_storage_cache cache;
+    t_storage *entry;
+    char line[256], *descr;
+    int types, cached_types, rows, count, index, type, allocunit;
+    long uptime, saved;
+    FILE *fp;
+
+    types = check_ram << TYPE_MEM | check_vmem << TYPE_VMEM | check_disk << TYPE_FIXED | check_net << TYPE_NET;
+
+    if ((fp = state_open_read(ss->peername, cache_kind)) == NULL)
+        return -1;
+
+    if (fscanf(fp, "types %d uptime %ld saved %ld rows %d\n", &cached_types, &uptime, &saved, &rows) != 4 ||
+        cached_types != types || rows < 0 || saved > time(NULL) || time(NULL) - saved >= cache_age) {
+        fclose(fp);
+        return -1;
     }
 
-    /* Fill the struct */
-    storage[index_storage].index = index_oid;
-    /* Copy string descr */
-    memcpy(storage[index_storage].descr, descr, descr_length);
-    storage[index_storage].type = type;
-    storage[index_storage].allocunit = allocunit;
-    storage[index_storage].totalsize = totalsize;
-    storage[index_storage].used = used;
+    cache.storage = malloc((rows > 0 ? rows : 1) * sizeof(t_storage));
+    cache.uptime = -1;
+    cache.missing = 0;
+
+    for (count = 0; count < rows && fgets(line, sizeof(line), fp) != NULL; count++) {
+        line[strcspn(line, "\n")] = '\0';
+        if (sscanf(line, "%d %d %d", &index, &type, &allocunit) != 3 ||
+            (descr = strchr(line, ' ')) == NULL || (descr = strchr(descr + 1, ' ')) == NULL ||
+            (descr = strchr(descr + 1, ' ')) == NULL)
+            break;
+
+        entry = &cache.storage[count];
+        newStorageEntry(entry, index, type);
+        entry->allocunit = allocunit;
+        strncpy((char *)entry->descr, descr + 1, sizeof(entry->descr) - 1);
+    }
+    fclose(fp);
+
+    if (count < rows) {
+        free(cache.storage);
+        return -1;
+    }
+
+    /* sysUpTime, then hrStorageSize and hrStorageUsed of each entry */
+    if (snmp_get_batch(ss, 1 + rows * CACHE_COLUMNS, STORAGE_VALUE_SIZE, cache_oid, cache_value, &cache) != 0 ||
+        cache.missing || cache.uptime < uptime) {
+        if (verbose)
+            printf("Storage cache of %s is outdated\n", ss->peername);
+        free(cache.storage);
+        return -1;
+    }
+
+    *storagep = cache.storage;
+
+    return rows;
+}
+
+/*
+ * writeStorageCache : save the entries found by a walk (-I)
+ *
+ *	args : ss = session, storage / index_storage = entries
+ *	       uptime = sysUpTime of the agent before the walk
+ */
+
+void writeStorageCache(netsnmp_session *ss, t_storage *storage, int index_storage, long uptime)
+{
+    int count, types;
+    FILE *fp;
+
+    types = check_ram << TYPE_MEM | check_vmem << TYPE_VMEM | check_disk << TYPE_FIXED | check_net << TYPE_NET;
+
+    if ((fp = state_open_write(ss->peername, cache_kind)) == NULL)
+        return;
+
+    fprintf(fp, "types %d uptime %ld saved %ld rows %d\n", types, uptime, (long)time(NULL), index_storage);
+    for (count = 0; count < index_storage; count++) {
+        storage[count].descr[strcspn((char *)storage[count].descr, "\r\n")] = '\0';
+        fprintf(fp, "%d %d %d %s\n", storage[count].index, storage[count].type, storage[count].allocunit,
+                storage[count].descr);
+    }
+
+    state_close_write(fp, ss->peername, cache_kind);
+}
+
+/*
+ * cache_oid : OID of the item-th object to get with the cache
+ *	       (snmp_get_batch callback) : sysUpTime, then CACHE_COLUMNS
+ *	       objects per entry : hrStorageSize, hrStorageUsed
+ */
+
+size_t cache_oid(int item, oid *name, void *ctx)
+{
+    t_storage_cache *cache = ctx;
+
+    if (item == 0) {
+        memmove(name, sysUpTime_mib, sizeof(sysUpTime_mib));
+        return sizeof(sysUpTime_mib) / sizeof(oid);
+    }
+
+    item--;
+    return storage_oid(item / CACHE_COLUMNS * STORAGE_COLUMNS + 2 + item % CACHE_COLUMNS, name, cache->storage);
+}
+
+/*
+ * cache_value : decode the item-th object of the cache check
+ *		 (snmp_get_batch callback)
+ */
+
+void cache_value(int item, netsnmp_variable_list *vars, void *ctx)
+{
+    t_storage_cache *cache = ctx;
+
+    if (vars == NULL || vars->type == SNMP_NOSUCHOBJECT || vars->type == SNMP_NOSUCHINSTANCE ||
+        vars->type == SNMP_ENDOFMIBVIEW) {
+        cache->missing = 1;
+        return;
+    }
+
+    if (item == 0) {
+        if (vars->type == ASN_TIMETICKS)
+            cache->uptime = *(vars->val).integer;
+        return;
+    }
 
-    return storage;
+    item--;
+    storage_value(item / CACHE_COLUMNS * STORAGE_COLUMNS + 2 + item % CACHE_COLUMNS, vars, cache->storage);
 }
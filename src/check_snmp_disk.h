@@ -25,8 +25,8 @@
 #define TYPE_FIXED 2
 #define TYPE_NET 3
 
-int verbose = 0;
-int perfdata = 0;
+static int verbose = 0;
+static int perfdata = 0;
 
 typedef struct store {
     int index;
@@ -38,26 +38,77 @@ typedef struct store {
 
 } t_storage;
 
-oid FIXED_DISK[] = { 1, 3, 6, 1, 2, 1, 25, 2, 1, 4 };
-oid VIRTUAL_MEM[] = { 1, 3, 6, 1, 2, 1, 25, 2, 1, 3 };
-oid RAM[] = { 1, 3, 6, 1, 2, 1, 25, 2, 1, 2 };
-oid NETWORK_DISK[] = { 1, 3, 6, 1, 2, 1, 25, 2, 1, 10 };
-oid objid_mib[] = { 1, 3, 6, 1, 2, 1, 25, 2, 3, 1, 2 };
-
-int warningmin = -1;
-int criticalmin = -1;
-int check_ram = 0;
-int check_disk = 0;
-int check_net = 0;
-int check_vmem = 0;
-int filteron = 0;
-int reserved = 0;
-char filter[20];
-
-void usage(void);
-int checkDisk(netsnmp_session * ss);
-int check_and_print(t_storage * storage, int index_storage);
-
-t_storage *newStorageEntry(int index_storage, t_storage * storage,
-                           unsigned char *descr, size_t descr_length,
-                           int allocunit, int totalsize, int used, int index_oid, int type);
+static oid FIXED_DISK[] = { 1, 3, 6, 1, 2, 1, 25, 2, 1, 4 };
+static oid VIRTUAL_MEM[] = { 1, 3, 6, 1, 2, 1, 25, 2, 1, 3 };
+static oid RAM[] = { 1, 3, 6, 1, 2, 1, 25, 2, 1, 2 };
+static oid NETWORK_DISK[] = { 1, 3, 6, 1, 2, 1, 25, 2, 1, 10 };
+static oid objid_mib[] = { 1, 3, 6, 1, 2, 1, 25, 2, 3, 1, 2 };
+static oid sysUpTime_mib[] = { 1, 3, 6, 1, 2, 1, 1, 3, 0 };
+
+static int warningmin = -1;
+static int criticalmin = -1;
+static int check_ram = 0;
+static int check_disk = 0;
+static int check_net = 0;
+static int check_vmem = 0;
+static int reserved = 0;
+static int lockstep = 0;
+static int cache_age = 0;
+static t_matcher *include = NULL;
+static t_matcher *exclude = NULL;
+static int skipped = 0;
+static char cache_kind[32] = "storage";
+
+int check_snmp_disk_main(int argc, char *argv[]);
+static void usage(void);
+static int checkHost(char *hostname, void *ctx);
+static int checkDisk(netsnmp_session * ss);
+static int check_and_print(t_storage * storage, int index_storage);
+
+/* Walk of hrStorageType : entries selected, memory apart */
+typedef struct storage_walk {
+    t_storage *storage;
+    int index_storage, allocated;
+    int mem_id, virtual_id;
+} t_storage_walk;
+
+static int walkStorageTypes(netsnmp_session * ss, t_storage ** storagep);
+static int storageType(int root, netsnmp_variable_list * vars, void *ctx);
+static int walkStorageTable(netsnmp_session * ss, t_storage ** storagep, int ncolumns);
+static int storage_cmp(const void *a, const void *b);
+static int selectedType(netsnmp_variable_list * vars);
+
+/* Columns walked together with -l : hrStorageType to hrStorageUsed */
+#define STORAGE_WALK_COLUMNS 5
+
+static void newStorageEntry(t_storage * entry, int index_oid, int type);
+
+/* Columns got for each entry, and mean size of their values */
+#define STORAGE_COLUMNS 4
+#define STORAGE_VALUE_SIZE 16
+
+static size_t storage_oid(int item, oid * name, void *ctx);
+static void storage_value(int item, netsnmp_variable_list * vars, void *ctx);
+
+/* Filters (-f / -F) : descriptions first, size and usage of the entries kept */
+static size_t descr_oid(int item, oid * name, void *ctx);
+static void descr_value(int item, netsnmp_variable_list * vars, void *ctx);
+static size_t usage_oid(int item, oid * name, void *ctx);
+static void usage_value(int item, netsnmp_variable_list * vars, void *ctx);
+static int filterStorage(t_storage * storage, int index_storage);
+
+/* Index cache (-I) : entries of the last walk, checked by a GET of sysUpTime
+ * and of hrStorageSize / hrStorageUsed of each entry
+ */
+typedef struct storage_cache {
+    t_storage *storage;
+    long uptime;
+    int missing;
+} t_storage_cache;
+
+#define CACHE_COLUMNS 2
+
+static int readStorageCache(netsnmp_session * ss, t_storage ** storagep);
+static void writeStorageCache(netsnmp_session * ss, t_storage * storage, int index_storage, long uptime);
+static size_t cache_oid(int item, oid * name, void *ctx);
+static void cache_value(int item, netsnmp_variable_list * vars, void *ctx);
@@ -35,6 +35,7 @@ void usage(void)
     fprintf(stderr, " -H HOST -C COMMUNITY -w xx -c xx -m STRING\n\n");
     fprintf(stderr,
             "  -H HOST\tHostname/IP to query\n"
+            "\t\t or a list of hosts : HOST1,HOST2,... or @FILE or - (stdin), one result per line\n"
             "  SNMP v1/2c:\n"
             "     -C COMMUNITY\tSNMP community name\n"
             "  SNMP v3:\n"
@@ -44,7 +45,13 @@ void usage(void)
             "     -x Protocol   Privacy protocol [DES|AES]\n"
             "     -X Passphrase Privacy protocol pass phrase\n"
             "  -s VERSION\tVERSION=[1|2c|3]\n"
+            "  -t INTEGER\tMax timeout in seconds : the timeout follows the round trip times of the host\n"
+            "  -v \t\tVerbose output (reads the MIB files)\n"
             "  -V \t\tPrint Version\n"
+            "  -P INTEGER\tWith a list of hosts : hosts checked at the same time (16 by default)\n"
+            "  -o FILE\tWith a list of hosts : write the result of each host in FILE\n"
+            "  -S stderr|perf\tCost of the check : requests, retries, bytes and time of each\n"
+            "\t\t\t phase, on stderr or as perfdata\n"
             "  -d \t\tProvide Performance data output\n"
             "  -m [W,L]\t\tDefine if windows or linux\n"
             "\t\t\t\t W = Monitor Windows machines (result in %%)\n"
@@ -53,16 +60,21 @@ void usage(void)
             "  -w INTEGER\t\tWarning limit in percent for Windows\n"
             "  -w INT,INT,INT\t\tWarning limits in load average for Linux\n"
             "  -c INTEGER\t\tCritical limit in percent for Windows\n"
-            "  -c INT,INT,INT\t\tCritical limits in load average for Linux\n");
+            "  -c INT,INT,INT\t\tCritical limits in load average for Linux\n"
+            "  -T STAT=INT,INT\tWarning and critical limits on other statistics for Windows\n"
+            "\t\t\t\t max = load of the busiest CPU (percent)\n"
+            "\t\t\t\t p95 = 95th percentile of the CPU loads (percent)\n"
+            "\t\t\t\t busy:PCT = number of CPUs loaded more than PCT percent\n"
+            "\t\t\t\t Example : -T max=95,100 -T busy:90=4,8 (may be repeated)\n");
 }
 
 /*
  * main function : -> parse command line args
  * 		   -> open SNMP session
  */
-int main(int argc, char *argv[])
+int check_snmp_load_main(int argc, char *argv[])
 {
-    netsnmp_session session, *ss = NULL;
+    netsnmp_session session;
     int opt;
     int exitcode = UNKNOWN;
     char *community = NULL;
@@ -72,8 +84,12 @@ int main(int argc, char *argv[])
     int version = SNMP_VERSION_1;
     char *token;
     snmpv3_args_t v3_args;
+    char **hosts = NULL;
+    char *statusfile = NULL;
+    int nhosts, parallel = FANOUT_DEFAULT;
 
     init_v3_args(&v3_args);
+    stats_start();
 
     /* Print the help if not arguments provided */
     if (argc == 1) {
@@ -84,7 +100,7 @@ int main(int argc, char *argv[])
      * get the common command line arguments
      */
 
-    while ((opt = getopt(argc, argv, "?hVdvt:w:c:m:C:H:s:u:p:k:x:X:")) != -1) {
+    while ((opt = getopt(argc, argv, LOAD_OPTIONS)) != -1) {
         switch (opt) {
         case '?':
         case 'h':
@@ -136,6 +152,31 @@ int main(int argc, char *argv[])
             printf("%s: Verbose mode\n", bn);
             break;
 
+        case 'P':
+            /* Hosts checked at the same time */
+            if (!is_integer(optarg) || atoi(optarg) < 1) {
+                printf("Parallel checks (%s) must be a positive integer!\n", optarg);
+                exit(UNKNOWN);
+            }
+
+            parallel = atoi(optarg);
+            break;
+
+        case 'S':
+            /* Cost of the check */
+            if (stats_mode(optarg) < 0) {
+                printf("Statistics (%s) must be stderr or perf\n", optarg);
+                exit(UNKNOWN);
+            }
+
+            stats_set_mode(stats_mode(optarg));
+            break;
+
+        case 'o':
+            /* Status file of a list of hosts */
+            statusfile = optarg;
+            break;
+
         case 'u':
         case 'p':
         case 'k':
@@ -144,6 +185,14 @@ int main(int argc, char *argv[])
             snmpv3_parseargs(verbose, opt, optarg, &v3_args);
             break;
 
+        case 'T':
+            /* Limits on the max, 95th percentile, number of busy CPUs */
+            if (parseStatLimit(optarg) != 0) {
+                printf("Format : -T max=xx,xx or -T p95=xx,xx or -T busy:PCT=xx,xx\n");
+                exit(UNKNOWN);
+            }
+            break;
+
         case 'm':
             /* WINDOWS / LINUX Check style */
             if (strcmp(optarg, "W") == 0) {
@@ -235,6 +284,11 @@ int main(int argc, char *argv[])
         exit(UNKNOWN);
     }
 
+    if (style == LINUX && (statwarn[STAT_MAX] != -1 || statwarn[STAT_P95] != -1 || statwarn[STAT_BUSY] != -1)) {
+        printf("-T is only for Windows monitoring (-m W)\n");
+        exit(UNKNOWN);
+    }
+
     if ((warningmin[0] == -1) || (criticalmin[0] == -1)) {
         printf("Must set the warning and critical values (-w and -c)\n");
         exit(UNKNOWN);
@@ -252,7 +306,7 @@ int main(int argc, char *argv[])
 
     snmp_sess_init(&session);
 
-    init_snmp("check_load");
+    snmp_startup("check_load", verbose);
 
     session.version = version;
 
@@ -262,6 +316,7 @@ int main(int argc, char *argv[])
         session.community = (unsigned char *)community;
         session.community_len = strlen(community);
     } else {
+        stats_phase("keys");
         snmpv3_set_session(&session, &v3_args);
     }
 
@@ -270,147 +325,208 @@ int main(int argc, char *argv[])
 
     SOCK_STARTUP;
 
+    /* List of hosts : check them all, the results are printed one per line */
+    if (hostname && (nhosts = snmp_hostlist(hostname, &hosts)) != 0) {
+        if (nhosts < 0) {
+            printf("Can't read the list of hosts %s\n", hostname + 1);
+            SOCK_CLEANUP;
+            exit(UNKNOWN);
+        }
+
+        exitcode = snmp_fanout(hosts, nhosts, parallel, statusfile, checkHost, &session);
+
+        while (nhosts > 0)
+            free(hosts[--nhosts]);
+        free(hosts);
+    } else {
+        exitcode = checkHost(hostname, &session);
+    }
+
+    SOCK_CLEANUP;
+
+    free(community);
+    free(hostname);
+
+    free_v3_args(&v3_args);
+
+    return exitcode;
+}
+
+#ifndef SNMP_DAEMON
+int main(int argc, char *argv[])
+{
+    return check_snmp_load_main(argc, argv);
+}
+#endif
+
+/*
+ * checkHost : open the SNMP session of a host, and check it
+ *
+ *	args : hostname, ctx = session prepared by main (version, community...)
+ *
+ *	return : Nagios code
+ */
+
+int checkHost(char *hostname, void *ctx)
+{
+    netsnmp_session *session = ctx, *ss;
+    int exitcode;
+
+    session->peername = hostname;
+    if (session->version == SNMP_VERSION_3)
+        stats_phase("keys");
+    snmpv3_load_keys(session);
+
     /*
      * open an SNMP session
      */
-    ss = snmp_open(&session);
+    stats_phase("open");
+    ss = snmp_open_session(session);
     if (ss == NULL) {
         /*
          * diagnose snmp_open errors with the input netsnmp_session pointer
          */
-        snmp_sess_perror("snmp_check_process", &session);
-        SOCK_CLEANUP;
-        exit(UNKNOWN);
+        snmp_sess_perror("check_snmp_load", session);
+        stats_print();
+        return UNKNOWN;
     }
 
-    exitcode = checkLoad(ss);
+    /* Timeout and retries from the round trip times of the host */
+    rtt_apply(ss, verbose);
 
-    snmp_close(ss);
+    exitcode = checkLoad(ss);
 
-    SOCK_CLEANUP;
+    stats_phase("close");
+    if (!snmp_session_shared(ss)) {
+        rtt_save();
+        snmpv3_save_keys(session, ss, exitcode == UNKNOWN);
+    }
 
-    free(community);
-    free(hostname);
+    snmp_close_session(ss);
 
-    free_v3_args(&v3_args);
+    stats_print();
 
     return exitcode;
 }
 
 int checkLoad(netsnmp_session *ss)
 {
-
-    netsnmp_pdu *response;
-    netsnmp_variable_list *vars;
-    oid name[MAX_OID_LEN];
-    size_t name_length;
-    oid root[MAX_OID_LEN];
-    size_t rootlen;
-    int running;
+    const oid *roots[1];
+    size_t rootlens[1];
     int exitval = 0;
     int cpunbr = 0;
+    int ret;
+
+    memset(&cpustats, 0, sizeof(cpustats));
+
+    /* Linux : the 3 loads in one request */
+    stats_phase("get");
+    if (style == LINUX && (cpunbr = getLinuxLoad(ss)) != 0) {
+        if (cpunbr < 0)
+            return UNKNOWN;
+        stats_phase("output");
+        return check_and_print(cpunbr);
+    }
 
     if (style == WINDOWS) {
-        memmove(root, win_mib, sizeof(win_mib));
-        rootlen = sizeof(win_mib) / sizeof(oid);
+        roots[0] = win_mib;
+        rootlens[0] = sizeof(win_mib) / sizeof(oid);
         /* Style == LINUX */
     } else {
-        memmove(root, linux_mib, sizeof(linux_mib));
-        rootlen = sizeof(linux_mib) / sizeof(oid);
+        roots[0] = linux_mib;
+        rootlens[0] = sizeof(linux_mib) / sizeof(oid);
     }
-    /*
-     * get first object to start walk
-     */
-    memmove(name, root, rootlen * sizeof(oid));
-    name_length = rootlen;
 
-    running = 1;
+    stats_phase("walk");
+    if ((ret = snmp_walk(ss, roots, rootlens, 1, loadValue, &cpunbr)) != 0) {
+        printf(ret == WALK_TIMEOUT ? "SNMP Error: timeout\n" :
+               ret == WALK_VISIT ? "Out of memory\n" : "Error in response");
+        return UNKNOWN;
+    }
 
-    while (running) {
+    stats_phase("output");
+    exitval = check_and_print(cpunbr);
 
-        if ((response = getResponse(name, name_length, ss, SNMP_MSG_GETNEXT)) == NULL) {
-            printf("SNMP Error: timeout\n");
-            return UNKNOWN;
-        }
+    return exitval;
+}
 
-        if (response->errstat == SNMP_ERR_NOERROR) {
-
-            /*
-             * check variables
-             */
-            for (vars = response->variables; vars; vars = vars->next_variable) {
-                if ((vars->name_length < rootlen) || (memcmp(root, vars->name, rootlen * sizeof(oid)) != 0)) {
-                    /*
-                     * not part of this subtree
-                     */
-                    running = 0;
-                    continue;
-                }
+/*
+ * loadValue : load of a CPU (Windows) or laLoad (Linux) (snmp_walk visitor)
+ */
 
-                if (verbose) {
-                    print_variable(vars->name, vars->name_length, vars);
-                }
+int loadValue(int root, netsnmp_variable_list *vars, void *ctx)
+{
+    int *cpunbr = ctx;
+    size_t length;
+    char buf[32];
 
-                if (style == WINDOWS) {
-                    if (vars->type == ASN_INTEGER) {
-                        /* Allocation de 10 en 10 */
-                        if (cpunbr == 0) {
-                            load = malloc(10 * sizeof(int));
-                        } else if ((cpunbr % 10) == 0) {
-                            load = realloc(load, (cpunbr + 10) * sizeof(int));
-                        }
-
-                        load[cpunbr++] = (*(vars->val).integer);
-                    }
-                }
+    if (verbose)
+        print_variable(vars->name, vars->name_length, vars);
 
-                if (style == LINUX) {
-                    if (vars->type == ASN_OCTET_STR) {
-                        char *temp = (char *)malloc(1 + vars->val_len);
-                        memcpy(temp, vars->val.string, vars->val_len);
-                        temp[vars->val_len] = '\0';
-                        if (strlen(temp) <= 5) {
-                            linload[cpunbr++] = strtod(temp, (char **)NULL);
-                        }
-                        free(temp);
-                    }
-                }
+    if (style == WINDOWS && vars->type == ASN_INTEGER) {
+        cpuSample(*(vars->val).integer);
+        (*cpunbr)++;
+    }
+
+    if (style == LINUX && vars->type == ASN_OCTET_STR && *cpunbr < 3) {
+        length = vars->val_len < sizeof(buf) ? vars->val_len : sizeof(buf) - 1;
+        memcpy(buf, vars->val.string, length);
+        buf[length] = '\0';
+        linload[(*cpunbr)++] = strtod(buf, (char **)NULL);
+    }
+
+    return 0;
+}
 
-                /* Test si ce n'est pas une exception */
+/*
+ * getLinuxLoad : get laLoadInt.1, .2 and .3 in linload
+ *
+ * return : 3 if ok, 0 if the agent doesn't have them (walk laLoad),
+ *	    -1 on timeout
+ */
 
-                if ((vars->type != SNMP_ENDOFMIBVIEW) &&
-                    (vars->type != SNMP_NOSUCHOBJECT) && (vars->type != SNMP_NOSUCHINSTANCE)) {
+int getLinuxLoad(netsnmp_session *ss)
+{
+    int found = 0;
 
-                    /* Et l'on avance dans la MIB :) */
+    if (snmp_get_batch(ss, 3, 8, laload_oid, laload_value, &found) != 0) {
+        printf("SNMP Error: timeout\n");
+        return -1;
+    }
 
-                    memmove((char *)name, (char *)vars->name, vars->name_length * sizeof(oid));
-                    name_length = vars->name_length;
-                }
+    return found == 3 ? 3 : 0;
+}
 
-                else
-                    /*
-                     * une exception , donc stop
-                     */
-                    running = 0;
-            }
-        }
+/*
+ * laload_oid : OID of laLoadInt.<item + 1> (snmp_get_batch callback)
+ */
 
-        else {
-            /*
-             * error in response, print it
-             */
-            running = 0;
-            printf("Error in response");
-            return UNKNOWN;
-        }
+size_t laload_oid(int item, oid *name, void *ctx)
+{
+    size_t length = sizeof(laLoadInt_mib) / sizeof(oid);
 
-        if (response)
-            snmp_free_pdu(response);
-    }
+    memmove(name, laLoadInt_mib, sizeof(laLoadInt_mib));
+    name[length - 1] = item + 1;
 
-    exitval = check_and_print(cpunbr);
+    return length;
+}
 
-    return exitval;
+/*
+ * laload_value : decode laLoadInt.<item + 1> (snmp_get_batch callback)
+ */
+
+void laload_value(int item, netsnmp_variable_list *vars, void *ctx)
+{
+    int *found = ctx;
+
+    if (vars == NULL || vars->type != ASN_INTEGER)
+        return;
+
+    if (verbose)
+        print_variable(vars->name, vars->name_length, vars);
+
+    linload[item] = *(vars->val).integer / 100.0;
+    (*found)++;
 }
 
 /*
@@ -428,36 +544,52 @@ int check_and_print(int cpunbr)
     double average = 0;
     int exitstatus = OK;
     int w = 0;
+    int stats[STAT_COUNT];
 
     if (style == WINDOWS) {
 
-        for (count = 0; count < cpunbr; count++) {
-            /* Average of cpu use */
-            average += load[count];
-            if (verbose) {
-                printf("Cpu no %d load=%d%% \n", count, load[count]);
-            }
+        if (cpunbr == 0) {
+            printf("UNKNOWN : no CPU found\n");
+            return UNKNOWN;
         }
-        average /= cpunbr;
 
-        free(load);
+        /* Average of cpu use */
+        average = (double)cpustats.sum / cpunbr;
+
+        stats[STAT_MAX] = cpustats.max;
+        stats[STAT_P95] = cpuPercentile(95);
+        if (busypct < 0)
+            busypct = warningmin[0];
+        stats[STAT_BUSY] = cpuAbove(busypct);
 
-        if (average > warningmin[0]) {
-            if (average > criticalmin[0]) {
-                printf("CRITICAL : ");
+        if (average > criticalmin[0])
+            exitstatus = CRITICAL;
+        else if (average > warningmin[0])
+            exitstatus = WARNING;
+
+        for (count = 0; count < STAT_COUNT; count++) {
+            if (statcrit[count] != -1 && stats[count] > statcrit[count])
                 exitstatus = CRITICAL;
-            } else {
+            else if (statwarn[count] != -1 && stats[count] > statwarn[count] && exitstatus == OK)
                 exitstatus = WARNING;
-                printf("WARNING : ");
-            }
+        }
+
+        if (exitstatus == CRITICAL) {
+            printf("CRITICAL : ");
+        } else if (exitstatus == WARNING) {
+            printf("WARNING : ");
         } else {
             printf("OK : ");
         }
+
+        printf("%d CPU :  %.2f%% (max %d%%, p95 %d%%, %d CPU > %d%%)", cpunbr, average, stats[STAT_MAX],
+               stats[STAT_P95], stats[STAT_BUSY], busypct);
+
         if (perfdata) {
-            printf("%d CPU :  %.2f%% | cpu_used_percent=%.2f%%;%d;%d", cpunbr, average, average, warningmin[0],
-                   criticalmin[0]);
-        } else {
-            printf("%d CPU :  %.2f%%", cpunbr, average);
+            printf(" | cpu_used_percent=%.2f%%;%d;%d", average, warningmin[0], criticalmin[0]);
+            printStatPerf("cpu_max_percent", stats[STAT_MAX], "%", STAT_MAX);
+            printStatPerf("cpu_p95_percent", stats[STAT_P95], "%", STAT_P95);
+            printStatPerf("cpu_busy", stats[STAT_BUSY], "", STAT_BUSY);
         }
     }
 
@@ -494,3 +626,98 @@ int check_and_print(int cpunbr)
 
     return exitstatus;
 }
+
+/*
+ * parseStatLimit : parse the limits of a statistic (-T STAT=WARN,CRIT)
+ *
+ * return : 0 if ok, -1 if the format is wrong
+ */
+
+int parseStatLimit(char *arg)
+{
+    int stat, warn, crit, pct = -1, n = 0;
+
+    if (sscanf(arg, "max=%d,%d%n", &warn, &crit, &n) == 2 && arg[n] == '\0') {
+        stat = STAT_MAX;
+    } else if (sscanf(arg, "p95=%d,%d%n", &warn, &crit, &n) == 2 && arg[n] == '\0') {
+        stat = STAT_P95;
+    } else if (sscanf(arg, "busy:%d=%d,%d%n", &pct, &warn, &crit, &n) == 3 && arg[n] == '\0') {
+        stat = STAT_BUSY;
+        if (pct < 0 || pct > 100)
+            return -1;
+        busypct = pct;
+    } else {
+        return -1;
+    }
+
+    if (warn < 0 || warn > crit)
+        return -1;
+
+    statwarn[stat] = warn;
+    statcrit[stat] = crit;
+
+    return 0;
+}
+
+/*
+ * cpuSample : add the load of a CPU to the statistics
+ */
+
+void cpuSample(int value)
+{
+    if (verbose)
+        printf("Cpu no %d load=%d%% \n", cpustats.count, value);
+
+    value = value < 0 ? 0 : value > 100 ? 100 : value;
+
+    cpustats.count++;
+    cpustats.sum += value;
+    cpustats.histogram[value]++;
+    if (value > cpustats.max)
+        cpustats.max = value;
+}
+
+/*
+ * cpuPercentile : load under which are percent % of the CPUs (nearest rank)
+ */
+
+int cpuPercentile(int percent)
+{
+    int value, rank, seen = 0;
+
+    rank = (percent * cpustats.count + 99) / 100;
+
+    for (value = 0; value < 100; value++) {
+        if ((seen += cpustats.histogram[value]) >= rank)
+            break;
+    }
+
+    return value;
+}
+
+/*
+ * cpuAbove : number of CPUs loaded more than percent %
+ */
+
+int cpuAbove(int percent)
+{
+    int value, count = 0;
+
+    for (value = percent < 0 ? 0 : percent + 1; value <= 100; value++)
+        count += cpustats.histogram[value];
+
+    return count;
+}
+
+/*
+ * printStatPerf : performance data of a statistic, with its limits if set
+ */
+
+void printStatPerf(const char *label, int value, const char *unit, int stat)
+{
+    printf(" %s=%d%s;", label, value, unit);
+    if (statwarn[stat] != -1)
+        printf("%d;%d", statwarn[stat], statcrit[stat]);
+    else
+        printf(";");
+}
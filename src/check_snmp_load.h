@@ -21,20 +21,58 @@
 #define WINDOWS 0
 #define LINUX 1
 
-int verbose = 0;
-int style = 3;
-int perfdata = 0;
+static int verbose = 0;
+static int style = 3;
+static int perfdata = 0;
 
-int *load;
-double linload[3];
+static double linload[3];
 
-const oid linux_mib[] = { 1, 3, 6, 1, 4, 1, 2021, 10, 1, 3 };
-const oid win_mib[] = { 1, 3, 6, 1, 2, 1, 25, 3, 3, 1, 2 };
+/* Windows : statistics of the CPU loads, updated with each CPU walked, so
+ * the memory used doesn't depend on the number of CPUs
+ */
+typedef struct cpustats {
+    int count;
+    long sum;
+    int max;
+    int histogram[101];         // number of CPUs per load percent
+} t_cpustats;
 
-int warningmin[3] = { -1, -1, -1 };
-int criticalmin[3] = { -1, -1, -1 };
+static t_cpustats cpustats;
 
-void usage(void);
-int checkLoad(netsnmp_session * ss);
+/* Limits on the statistics (-T), the mean being -w / -c */
+#define STAT_MAX 0
+#define STAT_P95 1
+#define STAT_BUSY 2
+#define STAT_COUNT 3
 
-int check_and_print(int cpunbr);
+static int statwarn[STAT_COUNT] = { -1, -1, -1 };
+static int statcrit[STAT_COUNT] = { -1, -1, -1 };
+static int busypct = -1;
+
+static const oid linux_mib[] = { 1, 3, 6, 1, 4, 1, 2021, 10, 1, 3 };
+static const oid laLoadInt_mib[] = { 1, 3, 6, 1, 4, 1, 2021, 10, 1, 5, 1 };
+static const oid win_mib[] = { 1, 3, 6, 1, 2, 1, 25, 3, 3, 1, 2 };
+
+static int warningmin[3] = { -1, -1, -1 };
+static int criticalmin[3] = { -1, -1, -1 };
+
+int check_snmp_load_main(int argc, char *argv[]);
+static void usage(void);
+static int checkHost(char *hostname, void *ctx);
+static int checkLoad(netsnmp_session * ss);
+
+static int check_and_print(int cpunbr);
+static int loadValue(int root, netsnmp_variable_list * vars, void *ctx);
+
+static int parseStatLimit(char *arg);
+static void cpuSample(int value);
+static int cpuPercentile(int percent);
+static int cpuAbove(int percent);
+static void printStatPerf(const char *label, int value, const char *unit, int stat);
+
+/* Linux : laLoadInt.1 to .3 (load * 100) in one GET, walk of laLoad if the
+ * agent doesn't have them
+ */
+static int getLinuxLoad(netsnmp_session * ss);
+static size_t laload_oid(int item, oid * name, void *ctx);
+static void laload_value(int item, netsnmp_variable_list * vars, void *ctx);
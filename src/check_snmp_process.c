@@ -20,6 +20,7 @@
 
 #include <net-snmp/net-snmp-config.h>
 #include <net-snmp/net-snmp-includes.h>
+#include <time.h>
 
 #include "snmp-common.h"
 #include "check_snmp_process.h"
@@ -32,10 +33,12 @@
 void usage(void)
 {
     fprintf(stderr, "USAGE: check_snmp_process ");
-    fprintf(stderr, " -H HOST -C COMMUNITY -w xx -c xx -m STRING\n\n");
+    fprintf(stderr, " -H HOST -C COMMUNITY -w xx -c xx -m STRING\n");
+    fprintf(stderr, "       check_snmp_process -H HOST -C COMMUNITY -N INTEGER [-G] [-m STRING] [-r INTEGER]\n\n");
     fprintf(stderr,
             " Required options :\n"
             "  -H HOST\tHostname/IP to query\n"
+            "\t\t or a list of hosts : HOST1,HOST2,... or @FILE or - (stdin), one result per line\n"
             "  SNMP v1/2c:\n"
             "     -C COMMUNITY\tSNMP community name\n"
             "  SNMP v3:\n"
@@ -47,25 +50,46 @@ void usage(void)
             "  -m STRING\tSTRING define which process to check (m=monitor)\n"
             "\t\t\t STRING = proc1,proc2,proc3\n"
             "\t\t\t Example : -m spoolsv.exe,svchost.exe\n"
+            "  -M MODE\tHow the names of -m match the running processes (case ignored)\n"
+            "\t\t\t exact = the whole name (default)\n"
+            "\t\t\t prefix = the names beginning with it (-m http : httpd)\n"
+            "\t\t\t truncated = the name, or its beginning : agents truncate long names\n"
+            "\t\t\t  (15 characters on Linux), the behaviour of the versions before 1.4\n"
+            "\t\t\t pattern = names, globs (httpd*) and regexes (~^java[0-9]+$)\n"
             "  -w INTEGER\tMax number of process before WARNING (Warn if >=)\n"
             "  -c INTEGER\tMax number of process before CRITICAL\n\n"
             " Additionals options :\n"
             "  -h -?\t\tPrint this help\n"
             "  -d \t\tProvide Performance data output(doesn't support multiple process check)\n"
             "  -s VERSION\tSNMP VERSION=[1|2c|3] (1 by default)\n"
+            "  -t INTEGER\tMax timeout in seconds : the timeout follows the round trip times of the host\n"
+            "  -W INTEGER\tMax number of outstanding requests (4 by default)\n"
+            "  -v \t\tVerbose output (reads the MIB files)\n"
             "  -V \t\tPrint Version\n"
+            "  -P INTEGER\tWith a list of hosts : hosts checked at the same time (16 by default)\n"
+            "  -o FILE\tWith a list of hosts : write the result of each host in FILE\n"
+            "  -S stderr|perf\tCost of the check : requests, retries, bytes and time of each\n"
+            "\t\t\t phase, on stderr or as perfdata\n"
+            "  -I SECONDS\tKeep the PIDs found for SECONDS, only their names are checked until\n"
+            "\t\t then (new instances of a process running are not seen before)\n"
             "  -r INTEGER\tMax value of ram in MB(sum of all the instances of a process)(throw a WARNING)\n"
             "  -R \t\tIf the memory check should throw a CRITICAL instead of a WARNING\n"
-            "  -A \t\tThrow a WARNING instead of a CRITICAL when no process detected\n ");
+            "  -U WARN,CRIT\tCPU used since the last check (sum of all the instances of a process),\n"
+            "\t\t in percent of one CPU\n"
+            "  -A \t\tThrow a WARNING instead of a CRITICAL when no process detected\n"
+            " Top-N mode :\n"
+            "  -N INTEGER\tList the N processes using the most memory (among the processes of -m\n"
+            "\t\t if given), WARNING if one uses more than -r MB (CRITICAL with -R)\n"
+            "  -G \t\tSum the memory of the processes with the same name\n ");
 }
 
 /*
  * main function : -> parse command line args
  * 		   -> open SNMP session
  */
-int main(int argc, char *argv[])
+int check_snmp_process_main(int argc, char *argv[])
 {
-    netsnmp_session session, *ss;
+    netsnmp_session session;
     int opt;
     int exitcode = UNKNOWN;
     char *community = NULL;
@@ -74,9 +98,14 @@ int main(int argc, char *argv[])
     int timeout = 0;
     int version = SNMP_VERSION_1;
     char *token;
+    int count;
     snmpv3_args_t v3_args;
+    char **hosts = NULL;
+    char *statusfile = NULL;
+    int nhosts, parallel = FANOUT_DEFAULT;
 
     init_v3_args(&v3_args);
+    stats_start();
 
     /* Print the help if not arguments provided */
     if (argc == 1) {
@@ -88,7 +117,7 @@ int main(int argc, char *argv[])
      * get the common command line arguments
      */
 
-    while ((opt = getopt(argc, argv, "?hVdvRAt:w:c:r:m:C:H:s:u:p:k:x:X:")) != -1) {
+    while ((opt = getopt(argc, argv, PROCESS_OPTIONS)) != -1) {
         switch (opt) {
         case '?':
         case 'h':
@@ -135,6 +164,74 @@ int main(int argc, char *argv[])
 
             break;
 
+        case 'W':
+            /* Outstanding requests */
+            if (!is_integer(optarg) || atoi(optarg) < 1) {
+                printf("Window (%s) must be a positive integer!\n", optarg);
+                exit(UNKNOWN);
+            }
+
+            snmp_set_window(atoi(optarg));
+            break;
+
+        case 'P':
+            /* Hosts checked at the same time */
+            if (!is_integer(optarg) || atoi(optarg) < 1) {
+                printf("Parallel checks (%s) must be a positive integer!\n", optarg);
+                exit(UNKNOWN);
+            }
+
+            parallel = atoi(optarg);
+            break;
+
+        case 'S':
+            /* Cost of the check */
+            if (stats_mode(optarg) < 0) {
+                printf("Statistics (%s) must be stderr or perf\n", optarg);
+                exit(UNKNOWN);
+            }
+
+            stats_set_mode(stats_mode(optarg));
+            break;
+
+        case 'o':
+            /* Status file of a list of hosts */
+            statusfile = optarg;
+            break;
+
+        case 'U':
+            /* CPU limits, in percent of one CPU */
+            if (sscanf(optarg, "%d,%d", &cpuwarn, &cpucrit) != 2 || cpuwarn < 0 || cpucrit < cpuwarn) {
+                printf("Format : -U WARN,CRIT\n in percent, WARN <= CRIT\n");
+                exit(UNKNOWN);
+            }
+            break;
+
+        case 'N':
+            /* Top-N memory mode */
+            if (!is_integer(optarg) || atoi(optarg) < 1) {
+                printf("Number of processes (%s) must be a positive integer!\n", optarg);
+                exit(UNKNOWN);
+            }
+
+            topn = atoi(optarg);
+            break;
+
+        case 'G':
+            /* Top-N by name */
+            topgroup = 1;
+            break;
+
+        case 'I':
+            /* Max age of the PID cache */
+            if (!is_integer(optarg) || atoi(optarg) < 1) {
+                printf("Cache age (%s) must be a positive integer!\n", optarg);
+                exit(UNKNOWN);
+            }
+
+            cache_age = atoi(optarg);
+            break;
+
         case 'u':
         case 'p':
         case 'k':
@@ -162,25 +259,20 @@ int main(int argc, char *argv[])
             /* STRING of process */
             /* Delimiter = , */
 
-            token = strtok(optarg, ",");
-            /* First process */
-            /* limit to 20 char */
-            if (strlen(token) < 20) {
-                /* Malloc of the *process table */
-                process = malloc(sizeof(t_process));
-                strcpy((process[procnbr]).procstr, token);
+            for (token = strtok(optarg, ","); token; token = strtok(NULL, ",")) {
+                /* Realloc to contain one more structure */
+                process = realloc(process, (procnbr + 1) * sizeof(t_process));
+                process[procnbr].procstr = strdup(token);
                 process[procnbr].nbr = 0;
                 procnbr++;
             }
-            /* Following process */
-            while ((token = strtok(NULL, ",")) != NULL) {
-                if (strlen(token) < 20) {
-                    /* Realloc to contain one more structure */
-                    process = realloc(process, (procnbr + 1) * sizeof(t_process));
-                    strcpy((process[procnbr]).procstr, token);
-                    process[procnbr].nbr = 0;
-                    procnbr++;
-                }
+            break;
+
+        case 'M':
+            /* How the names match */
+            if ((matchmode = matcher_mode(optarg)) < 0) {
+                printf("Match mode (%s) must be exact, prefix, truncated or pattern\n", optarg);
+                exit(UNKNOWN);
             }
             break;
 
@@ -230,7 +322,7 @@ int main(int argc, char *argv[])
         }
     }
 
-    if ((warningmin == -1) || (criticalmin == -1)) {
+    if (topn == 0 && ((warningmin == -1) || (criticalmin == -1))) {
         printf("Warning limit or/and Critical limit not set (-w /-c)\n");
         exit(UNKNOWN);
     }
@@ -245,7 +337,7 @@ int main(int argc, char *argv[])
         exit(UNKNOWN);
     }
 
-    if (procnbr == 0) {
+    if (procnbr == 0 && topn == 0) {
         printf("You must specify process to search with -m <processlist>\n");
         exit(UNKNOWN);
     }
@@ -256,9 +348,18 @@ int main(int argc, char *argv[])
         exit(UNKNOWN);
     }
 
+    /* All the names compiled once */
+    matcher = matcher_new(matchmode);
+    for (count = 0; count < procnbr; count++) {
+        if (matcher_add(matcher, process[count].procstr, &process[count]) != 0) {
+            printf("Invalid regular expression : %s\n", process[count].procstr + 1);
+            exit(UNKNOWN);
+        }
+    }
+
     snmp_sess_init(&session);
 
-    init_snmp("check_process");
+    snmp_startup("check_process", verbose);
 
     session.version = version;
 
@@ -267,6 +368,7 @@ int main(int argc, char *argv[])
         session.community = (unsigned char *)community;
         session.community_len = strlen(community);
     } else {
+        stats_phase("keys");
         snmpv3_set_session(&session, &v3_args);
     }
 
@@ -275,30 +377,86 @@ int main(int argc, char *argv[])
 
     SOCK_STARTUP;
 
+    /* List of hosts : check them all, the results are printed one per line */
+    if (hostname && (nhosts = snmp_hostlist(hostname, &hosts)) != 0) {
+        if (nhosts < 0) {
+            printf("Can't read the list of hosts %s\n", hostname + 1);
+            SOCK_CLEANUP;
+            exit(UNKNOWN);
+        }
+
+        exitcode = snmp_fanout(hosts, nhosts, parallel, statusfile, checkHost, &session);
+
+        while (nhosts > 0)
+            free(hosts[--nhosts]);
+        free(hosts);
+    } else {
+        exitcode = checkHost(hostname, &session);
+    }
+
+    SOCK_CLEANUP;
+
+    free(community);
+    free(hostname);
+    free_v3_args(&v3_args);
+    matcher_free(matcher);
+
+    return exitcode;
+}
+
+#ifndef SNMP_DAEMON
+int main(int argc, char *argv[])
+{
+    return check_snmp_process_main(argc, argv);
+}
+#endif
+
+/*
+ * checkHost : open the SNMP session of a host, and check it
+ *
+ *	args : hostname, ctx = session prepared by main (version, community...)
+ *
+ *	return : Nagios code
+ */
+
+int checkHost(char *hostname, void *ctx)
+{
+    netsnmp_session *session = ctx, *ss;
+    int exitcode;
+
+    session->peername = hostname;
+    if (session->version == SNMP_VERSION_3)
+        stats_phase("keys");
+    snmpv3_load_keys(session);
+
     /*
      * open an SNMP session
      */
-    ss = snmp_open(&session);
+    stats_phase("open");
+    ss = snmp_open_session(session);
     if (ss == NULL) {
         /*
          * diagnose snmp_open errors with the input netsnmp_session pointer
          */
-        snmp_sess_perror("snmp_check_process", &session);
-        SOCK_CLEANUP;
-        exit(UNKNOWN);
+        snmp_sess_perror("check_snmp_process", session);
+        stats_print();
+        return UNKNOWN;
     }
 
-    /* go to the principal function */
+    /* Timeout and retries from the round trip times of the host */
+    rtt_apply(ss, verbose);
 
     exitcode = checkProc(ss);
 
-    snmp_close(ss);
+    stats_phase("close");
+    if (!snmp_session_shared(ss)) {
+        rtt_save();
+        snmpv3_save_keys(session, ss, exitcode == UNKNOWN);
+    }
 
-    SOCK_CLEANUP;
+    snmp_close_session(ss);
 
-    free(community);
-    free(hostname);
-    free_v3_args(&v3_args);
+    stats_print();
 
     return exitcode;
 }
@@ -314,127 +472,100 @@ int main(int argc, char *argv[])
 
 int checkProc(netsnmp_session *ss)
 {
-
-    netsnmp_pdu *response;
-    netsnmp_variable_list *vars;
-    oid name[MAX_OID_LEN];
-    size_t name_length;
-    oid root[MAX_OID_LEN];
-    size_t rootlen;
-    int count;
-    int running;
+    const oid *roots[] = { objid_mib };
+    size_t rootlens[] = { sizeof(objid_mib) / sizeof(oid) };
     int exitval = 0;
-    int nbr;
-    int processid = 0;
-
-    t_process *procactuel;
-
-    memmove(root, objid_mib, sizeof(objid_mib));
-    rootlen = sizeof(objid_mib) / sizeof(oid);
-    /*
-     * get first object to start
-     */
-    memmove(name, root, rootlen * sizeof(oid));
-    name_length = rootlen;
-
-    running = 1;
-
-    while (running) {
-        if ((response = getResponse(name, name_length, ss, SNMP_MSG_GETNEXT)) == NULL) {
-            printf("SNMP Error: timeout\n");
-            return UNKNOWN;
+    int ret;
+
+    if (topn > 0)
+        return checkTop(ss);
+
+    /* PIDs of the last walk, if they still run the same processes */
+    if (cache_age > 0) {
+        stats_phase("cache");
+        if (readPidCache(ss) == 0) {
+            exitval = check_and_print(ss, procnbr);
+            free(process);
+            return exitval;
         }
-        /* TODO handle Auth failed and important error codes */
-        if (response->errstat == SNMP_ERR_NOERROR) {
-            /*
-             * check variables
-             */
-            for (vars = response->variables; vars; vars = vars->next_variable) {
-                if ((vars->name_length < rootlen) || (memcmp(root, vars->name, rootlen * sizeof(oid)) != 0)) {
-                    /*
-                     * not part of this subtree
-                     */
-                    running = 0;
-                    continue;
-                }
+    }
 
-                if (verbose) {
-                    print_variable(vars->name, vars->name_length, vars);
-                }
-                /* If the value is a STRING */
-                if (vars->type == ASN_OCTET_STR) {
+    /* TODO handle Auth failed and important error codes */
+    stats_phase("walk");
+    if ((ret = snmp_walk(ss, roots, rootlens, 1, foundName, NULL)) != 0) {
+        printf(ret == WALK_TIMEOUT ? "SNMP Error: timeout\n" :
+               ret == WALK_VISIT ? "Out of memory\n" : "Error in response");
+        return UNKNOWN;
+    }
 
-                    /* Check if the string is equal to a searched one
-                     * (ie : in argument (-m) )
-                     */
-                    for (count = 0, procactuel = process; count < procnbr; count++, procactuel++) {
+    if (cache_age > 0) {
+        stats_phase("cache");
+        writePidCache(ss);
+    }
 
-                        /* Case ignored */
+    /* Go to check and print */
+    exitval = check_and_print(ss, procnbr);
 
-                        if (!strncasecmp((vars->val).string, procactuel->procstr, vars->val_len)) {
+    free(process);
 
-                            /* Copy of the INDEX (last number of OID) */
-                            processid = (int)vars->name[11];
-                            nbr = procactuel->nbr;
+    return exitval;
+}
 
-                            /* Fill the index table */
+/*
+ * matchProcess : if the hrSWRunName varbind is the process searched (-M)
+ */
 
-                            /* If the table is empty : malloc for 10 int */
-                            if (nbr == 0) {
-                                procactuel->index = malloc(10 * sizeof(int));
-                            }
-                            /* If 10,20,30 index are in table index, realloc
-                             * 10 more int
-                             */
-                            else if ((nbr % 10) == 0) {
-                                procactuel->index = realloc(procactuel->index, (nbr + 10) * sizeof(int));
-                            }
+int matchProcess(netsnmp_variable_list *vars, t_process *proc)
+{
+    t_procmatch match = { proc, 0 };
 
-                            /* Copy of the INDEX in the table */
+    if (vars->type == ASN_OCTET_STR)
+        matcher_find(matcher, (char *)(vars->val).string, vars->val_len, foundProcess, &match);
 
-                            procactuel->index[nbr] = processid;
+    return match.found;
+}
 
-                            /* Incrementation of the number of index */
+/*
+ * foundProcess / foundPid : matcher callbacks, data = process matching
+ */
 
-                            (procactuel->nbr)++;
-                        }
-                    }
-                }
+void foundProcess(void *data, void *ctx)
+{
+    t_procmatch *match = ctx;
 
-                /*  exception check */
+    if (match->proc == data)
+        match->found = 1;
+}
 
-                if ((vars->type != SNMP_ENDOFMIBVIEW) &&
-                    (vars->type != SNMP_NOSUCHOBJECT) && (vars->type != SNMP_NOSUCHINSTANCE)) {
+void foundPid(void *data, void *ctx)
+{
+    addProcessIndex(data, *(int *)ctx);
+}
 
-                    /* walk in the MIB :) */
+/*
+ * addProcessIndex : add a PID to the index table of a process
+ */
 
-                    memmove((char *)name, (char *)vars->name, vars->name_length * sizeof(oid));
-                    name_length = vars->name_length;
-                } else
-                    /*
-                     * exception , so stop
-                     */
-                    running = 0;
-            }
-        } else {
-            /*
-             * error in response, print it
-             */
-            running = 0;
-            printf("Error in response");
-            return UNKNOWN;
-        }
+void addProcessIndex(t_process *proc, int pid)
+{
+    int nbr = proc->nbr;
 
-        if (response)
-            snmp_free_pdu(response);
+    /* If the table is empty : malloc for 10 int */
+    if (nbr == 0) {
+        proc->index = malloc(10 * sizeof(int));
+    }
+    /* If 10,20,30 index are in table index, realloc
+     * 10 more int
+     */
+    else if ((nbr % 10) == 0) {
+        proc->index = realloc(proc->index, (nbr + 10) * sizeof(int));
     }
 
-    /* Go to check and print */
-    exitval = check_and_print(ss, procnbr);
-
-    free(process);
+    /* Copy of the INDEX in the table */
+    proc->index[nbr] = pid;
 
-    return exitval;
+    /* Incrementation of the number of index */
+    (proc->nbr)++;
 }
 
 /*
@@ -447,15 +578,19 @@ int checkProc(netsnmp_session *ss)
 int check_and_print(netsnmp_session *ss, int procnbr)
 {
 
-    int count, count2, nbr, somme_ram;
+    int count, nbr, somme_ram;
     int exitstatus = OK;
-    int *index;
     t_process *procactuel = process;
+    char cpustr[32] = "";
 
-    /* The oid for RAM check */
-    oid ram[] = { 1, 3, 6, 1, 2, 1, 25, 5, 1, 1, 2, 0 };
+    /* RAM (and CPU) CHECK : all the process found, in batched requests */
+    stats_phase("get");
+    if (getProcessPerf(ss, procnbr) != 0) {
+        printf("SNMP Error: timeout\n");
+        return UNKNOWN;
+    }
 
-    size_t ramlen = sizeof(ram) / sizeof(oid);
+    stats_phase("output");
 
     /* Parse process structure */
     for (count = 0; count < procnbr; count++, procactuel++) {
@@ -484,20 +619,10 @@ int check_and_print(netsnmp_session *ss, int procnbr)
             continue;
         }
 
-        /* RAM CHECK */
-
-        index = procactuel->index;
-        somme_ram = 0;
-
-        for (count2 = 0; count2 < nbr; count2++) {
-            /* Sum of memory */
-            ram[11] = index[count2];
-            somme_ram += snmp_get_int(ss, ram, ramlen);
-        }
         /* We don't need the index table anymore */
         free(procactuel->index);
 
-        procactuel->ram = somme_ram;
+        somme_ram = procactuel->ram;
 
         /* Check if the number of proc excess limit */
 
@@ -521,14 +646,752 @@ int check_and_print(netsnmp_session *ss, int procnbr)
                 exitstatus = CRITICAL;
             }
         }
+        if (cpuwarn >= 0) {
+            if (procactuel->cpu > cpucrit) {
+                if (exitstatus != CRITICAL)
+                    printf("CRITICAL : ");
+                exitstatus = CRITICAL;
+            } else if (procactuel->cpu > cpuwarn && exitstatus == OK) {
+                exitstatus = WARNING;
+                printf("WARNING : ");
+            }
+
+            /* No CPU on the first check of a process */
+            if (procactuel->cpu >= 0)
+                snprintf(cpustr, sizeof(cpustr), ", CPU:%.1f%%", procactuel->cpu);
+            else
+                snprintf(cpustr, sizeof(cpustr), ", CPU:n/a");
+        }
         if (perfdata) {
-            printf("%d %s Running (Ram:%.2f MB) | proc_nbr=%d;%d;%d,proc_ram=%dKB", nbr, procactuel->procstr,
-                   somme_ram / (double)1024, nbr, warningmin, criticalmin, somme_ram);
+            printf("%d %s Running (Ram:%.2f MB%s) | proc_nbr=%d;%d;%d,proc_ram=%dKB", nbr, procactuel->procstr,
+                   somme_ram / (double)1024, cpustr, nbr, warningmin, criticalmin, somme_ram);
+            if (cpuwarn >= 0 && procactuel->cpu >= 0)
+                printf(",proc_cpu=%.1f%%;%d;%d", procactuel->cpu, cpuwarn, cpucrit);
         } else {
-            printf("%d %s Running (Ram:%.2f MB) --", nbr, procactuel->procstr, somme_ram / (double)1024);
+            printf("%d %s Running (Ram:%.2f MB%s) --", nbr, procactuel->procstr, somme_ram / (double)1024, cpustr);
         }
     }
 
     printf("\n");
     return exitstatus;
 }
+
+/*
+ * getProcessPerf : sum hrSWRunPerfMem of the PIDs found for each process
+ *		    in procactuel->ram (KB), and with -U their CPU usage since
+ *		    the last check in procactuel->cpu
+ *
+ *	All the PIDs are asked in batched GETs (many varbinds per PDU).
+ *	A process which exited since the walk has no hrSWRunPerfMem anymore
+ *	(noSuchInstance, or noSuchName in v1) : it just doesn't count.
+ *
+ * return : 0 if ok, -1 on timeout
+ */
+
+int getProcessPerf(netsnmp_session *ss, int procnbr)
+{
+    t_perf perf;
+    t_process *procactuel;
+    int count, count2, total = 0, ret;
+
+    for (count = 0, procactuel = process; count < procnbr; count++, procactuel++) {
+        procactuel->ram = 0;
+        procactuel->cpu = -1;
+        total += procactuel->nbr;
+    }
+
+    if (total == 0)
+        return 0;
+
+    /* Flat list of all the PIDs */
+    perf.pids = malloc(total * sizeof(t_pidref));
+    perf.columns = cpuwarn >= 0 ? PERF_COLUMNS_CPU : 1;
+    total = 0;
+
+    for (count = 0, procactuel = process; count < procnbr; count++, procactuel++) {
+        for (count2 = 0; count2 < procactuel->nbr; count2++, total++) {
+            perf.pids[total].pid = procactuel->index[count2];
+            perf.pids[total].proc = procactuel;
+            perf.pids[total].cpu = -1;
+            perf.pids[total].name[0] = '\0';
+        }
+    }
+
+    ret = snmp_get_batch(ss, total * perf.columns, RAM_VALUE_SIZE, perf_oid, perf_value, &perf);
+
+    if (ret == 0 && cpuwarn >= 0)
+        processCpu(ss, perf.pids, total);
+
+    free(perf.pids);
+
+    return ret;
+}
+
+/*
+ * perf_oid : OID of the item-th object (snmp_get_batch callback)
+ *	      hrSWRunPerfMem.<pid>, and with -U hrSWRunPerfCPU.<pid> and
+ *	      hrSWRunName.<pid>
+ */
+
+size_t perf_oid(int item, oid *name, void *ctx)
+{
+    t_perf *perf = ctx;
+    const oid *column[PERF_COLUMNS_CPU] = { ram_mib, cpu_mib, objid_mib };
+
+    memmove(name, column[item % perf->columns], sizeof(ram_mib));
+    name[sizeof(ram_mib) / sizeof(oid)] = perf->pids[item / perf->columns].pid;
+
+    return sizeof(ram_mib) / sizeof(oid) + 1;
+}
+
+/*
+ * perf_value : add the memory of the item-th PID to its process, or keep
+ *		its CPU counter / name (snmp_get_batch callback)
+ */
+
+void perf_value(int item, netsnmp_variable_list *vars, void *ctx)
+{
+    t_perf *perf = ctx;
+    t_pidref *pid = &perf->pids[item / perf->columns];
+    size_t length;
+
+    switch (item % perf->columns) {
+    case 0:
+        if (vars && vars->type == ASN_INTEGER) {
+            pid->proc->ram += *(vars->val).integer;
+        } else if (verbose) {
+            printf("No memory for PID %d (process exited ?)\n", pid->pid);
+        }
+        break;
+
+    case 1:
+        if (vars && vars->type == ASN_INTEGER)
+            pid->cpu = *(vars->val).integer;
+        break;
+
+    case 2:
+        if (vars && vars->type == ASN_OCTET_STR) {
+            length = vars->val_len < PROC_NAME_MAX ? vars->val_len : PROC_NAME_MAX;
+            memcpy(pid->name, vars->val.string, length);
+            pid->name[length] = '\0';
+        }
+        break;
+    }
+}
+
+/*
+ * processCpu : CPU usage of each process since the last check (-U)
+ *
+ *	The CPU counter of each PID is kept in a state file with the time it
+ *	was got. The CPU % of a process is the sum, for its PIDs, of the
+ *	increase of the counter divided by the time elapsed. A PID is only
+ *	counted if it was seen the last time running the same program (PIDs
+ *	are reused). Each set of processes (-m, -M) has its own state file :
+ *	the checks of the same host don't replace the counters of the others.
+ *
+ *	args : ss = session, pids / total = PIDs with their counter and name
+ *	       (sorted by PID here : a PID may be in several processes)
+ */
+
+void processCpu(netsnmp_session *ss, t_pidref *pids, int total)
+{
+    t_pidref *prev = NULL, *found;
+    t_process *procactuel;
+    struct timeval now;
+    long long now_ms, elapsed;
+    char *line = NULL, *name, kind[STATE_KIND_MAX];
+    size_t size = 0;
+    int count, nprev = 0, allocated = 0;
+    double rate = -1;
+    FILE *fp;
+
+    gettimeofday(&now, NULL);
+    now_ms = now.tv_sec * 1000LL + now.tv_usec / 1000;
+
+    for (count = 0; count < total; count++)
+        pids[count].cpu_ms = now_ms;
+
+    /* State file of this set of processes : "cpu-HASH" */
+    stateKind("cpu", kind, sizeof(kind));
+
+    /* Counters of the last check : "PID CPU TIME_MS NAME" */
+    if ((fp = state_open_read(ss->peername, kind)) != NULL) {
+        while (getline(&line, &size, fp) > 0) {
+            if (nprev == allocated) {
+                allocated = allocated ? allocated * 2 : 64;
+                prev = realloc(prev, allocated * sizeof(t_pidref));
+            }
+
+            line[strcspn(line, "\n")] = '\0';
+            if (sscanf(line, "%d %ld %lld", &prev[nprev].pid, &prev[nprev].cpu, &prev[nprev].cpu_ms) != 3 ||
+                (name = strchr(line, ' ')) == NULL || (name = strchr(name + 1, ' ')) == NULL ||
+                (name = strchr(name + 1, ' ')) == NULL || prev[nprev].cpu_ms >= now_ms ||
+                now_ms - prev[nprev].cpu_ms > CPU_STATE_AGE * 1000LL)
+                continue;
+
+            strncpy(prev[nprev].name, name + 1, PROC_NAME_MAX);
+            prev[nprev].name[PROC_NAME_MAX] = '\0';
+            prev[nprev].proc = NULL;
+            nprev++;
+        }
+        free(line);
+        fclose(fp);
+    }
+
+    if (nprev > 1)
+        qsort(prev, nprev, sizeof(t_pidref), pidref_cmp);
+    if (total > 1)
+        qsort(pids, total, sizeof(t_pidref), pidref_cmp);
+
+    for (count = 0; count < total; count++) {
+        /* A PID matched by several processes : the same rate for each one */
+        if (count == 0 || pids[count].pid != pids[count - 1].pid) {
+            rate = -1;
+            if (pids[count].cpu < 0 || nprev == 0 ||
+                (found = bsearch(&pids[count], prev, nprev, sizeof(t_pidref), pidref_cmp)) == NULL)
+                continue;
+
+            elapsed = now_ms - found->cpu_ms;
+            if (strcmp(found->name, pids[count].name) != 0 || found->cpu > pids[count].cpu || elapsed <= 0)
+                continue;
+
+            /* centi-seconds of CPU per second = percent */
+            rate = (pids[count].cpu - found->cpu) * 1000.0 / elapsed;
+        }
+        if (rate < 0)
+            continue;
+
+        procactuel = pids[count].proc;
+        if (procactuel->cpu < 0)
+            procactuel->cpu = 0;
+        procactuel->cpu += rate;
+    }
+
+    if ((fp = state_open_write(ss->peername, kind)) != NULL) {
+        for (count = 0; count < total; count++) {
+            if (pids[count].cpu >= 0 && (count == 0 || pids[count].pid != pids[count - 1].pid))
+                fprintf(fp, "%d %ld %lld %s\n", pids[count].pid, pids[count].cpu, now_ms, pids[count].name);
+        }
+
+        state_close_write(fp, ss->peername, kind);
+    }
+
+    free(prev);
+}
+
+/*
+ * pidref_cmp : qsort / bsearch order of the PIDs
+ */
+
+int pidref_cmp(const void *a, const void *b)
+{
+    const t_pidref *pa = a, *pb = b;
+
+    return (pa->pid > pb->pid) - (pa->pid < pb->pid);
+}
+
+/*
+ * readPidCache : PIDs saved by the last walk (-I), in the index tables of
+ *		  the processes
+ *
+ *	The cache is used if it was made for the same -m, is younger than -I
+ *	seconds, each process had at least one PID, and all the PIDs still
+ *	run the process they were found for (one batched GET of hrSWRunName).
+ *
+ * return : 0 if the index tables are filled, -1 if the table must be walked
+ */
+
+int readPidCache(netsnmp_session *ss)
+{
+    t_pid_cache cache;
+    t_process *procactuel;
+    char *line = NULL, *p, *end, kind[STATE_KIND_MAX];
+    size_t size = 0;
+    int count, count2, nbr, total = 0, valid;
+    long saved;
+    FILE *fp;
+
+    stateKind("pids", kind, sizeof(kind));
+    if ((fp = state_open_read(ss->peername, kind)) == NULL)
+        return -1;
+
+    valid = fscanf(fp, "saved %ld procs %d\n", &saved, &nbr) == 2 && nbr == procnbr && saved <= time(NULL) &&
+        time(NULL) - saved < cache_age;
+
+    /* One line per process : PID count, PIDs, name (the names of -m in
+     * any order share the file) */
+    for (count = 0; valid && count < procnbr; count++) {
+        if (getline(&line, &size, fp) < 0) {
+            valid = 0;
+            break;
+        }
+        line[strcspn(line, "\n")] = '\0';
+
+        nbr = strtol(line, &p, 10);
+        valid = nbr > 0;
+        for (count2 = 0; valid && count2 < nbr; count2++) {
+            strtol(p, &end, 10);
+            valid = end != p;
+            p = end;
+        }
+        if (!valid || *p != ' ') {
+            valid = 0;
+            break;
+        }
+
+        /* The process of this name not filled yet */
+        for (count2 = 0, procactuel = process; count2 < procnbr; count2++, procactuel++) {
+            if (procactuel->nbr == 0 && !strcmp(p + 1, procactuel->procstr))
+                break;
+        }
+        if (count2 == procnbr) {
+            valid = 0;
+            break;
+        }
+
+        strtol(line, &p, 10);
+        for (count2 = 0; count2 < nbr; count2++)
+            addProcessIndex(procactuel, strtol(p, &p, 10));
+        total += procactuel->nbr;
+    }
+    free(line);
+    fclose(fp);
+
+    if (valid) {
+        /* Flat list of all the PIDs, to check their names */
+        cache.pids = malloc(total * sizeof(t_pidref));
+        cache.changed = 0;
+        total = 0;
+
+        for (count = 0, procactuel = process; count < procnbr; count++, procactuel++) {
+            for (count2 = 0; count2 < procactuel->nbr; count2++, total++) {
+                cache.pids[total].pid = procactuel->index[count2];
+                cache.pids[total].proc = procactuel;
+            }
+        }
+
+        valid = snmp_get_batch(ss, total, NAME_VALUE_SIZE, name_oid, name_value, &cache) == 0 && !cache.changed;
+        free(cache.pids);
+    }
+
+    if (valid)
+        return 0;
+
+    if (verbose)
+        printf("PID cache of %s is outdated\n", ss->peername);
+
+    for (count = 0, procactuel = process; count < procnbr; count++, procactuel++) {
+        if (procactuel->nbr > 0)
+            free(procactuel->index);
+        procactuel->nbr = 0;
+    }
+
+    return -1;
+}
+
+/*
+ * writePidCache : save the PIDs found by a walk (-I)
+ *		   Not saved if a process wasn't found : it must be
+ *		   searched again on the next run.
+ */
+
+void writePidCache(netsnmp_session *ss)
+{
+    t_process *procactuel;
+    char kind[STATE_KIND_MAX];
+    int count, count2;
+    FILE *fp;
+
+    stateKind("pids", kind, sizeof(kind));
+
+    for (count = 0, procactuel = process; count < procnbr; count++, procactuel++) {
+        if (procactuel->nbr == 0) {
+            state_remove(ss->peername, kind);
+            return;
+        }
+    }
+
+    if ((fp = state_open_write(ss->peername, kind)) == NULL)
+        return;
+
+    fprintf(fp, "saved %ld procs %d\n", (long)time(NULL), procnbr);
+    for (count = 0, procactuel = process; count < procnbr; count++, procactuel++) {
+        fprintf(fp, "%d", procactuel->nbr);
+        for (count2 = 0; count2 < procactuel->nbr; count2++)
+            fprintf(fp, " %d", procactuel->index[count2]);
+        fprintf(fp, " %s\n", procactuel->procstr);
+    }
+
+    state_close_write(fp, ss->peername, kind);
+}
+
+/*
+ * stateKind : name of a state file of this set of processes, from -M and
+ *	       the names of -m in any order : the process checks of a host
+ *	       don't share their files
+ */
+
+void stateKind(const char *prefix, char *kind, size_t size)
+{
+    unsigned int hash = 5381;
+    const char **names;
+    const char *p;
+    int count;
+
+    hash = hash * 33 + matchmode;
+
+    if ((names = malloc(procnbr * sizeof(char *))) != NULL) {
+        for (count = 0; count < procnbr; count++)
+            names[count] = process[count].procstr;
+        qsort(names, procnbr, sizeof(char *), name_cmp);
+
+        for (count = 0; count < procnbr; count++) {
+            for (p = names[count]; *p; p++)
+                hash = hash * 33 + (unsigned char)*p;
+            hash = hash * 33 + ',';
+        }
+        free(names);
+    }
+
+    snprintf(kind, size, "%s-%08x", prefix, hash);
+}
+
+int name_cmp(const void *a, const void *b)
+{
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+/*
+ * name_oid : hrSWRunName.<pid> of the item-th cached PID
+ *	      (snmp_get_batch callback)
+ */
+
+size_t name_oid(int item, oid *name, void *ctx)
+{
+    t_pid_cache *cache = ctx;
+
+    memmove(name, objid_mib, sizeof(objid_mib));
+    name[sizeof(objid_mib) / sizeof(oid)] = cache->pids[item].pid;
+
+    return sizeof(objid_mib) / sizeof(oid) + 1;
+}
+
+/*
+ * name_value : check that the item-th cached PID still runs its process
+ *		(snmp_get_batch callback)
+ */
+
+void name_value(int item, netsnmp_variable_list *vars, void *ctx)
+{
+    t_pid_cache *cache = ctx;
+
+    if (vars == NULL || !matchProcess(vars, cache->pids[item].proc))
+        cache->changed = 1;
+}
+
+/*
+ * foundName : hrSWRunName of a process (snmp_walk visitor)
+ */
+
+int foundName(int root, netsnmp_variable_list *vars, void *ctx)
+{
+    int pid;
+
+    if (verbose)
+        print_variable(vars->name, vars->name_length, vars);
+
+    /* If the value is a STRING : PID (last number of OID) added to
+     * each process searched (-m) matching
+     */
+    if (vars->type == ASN_OCTET_STR) {
+        pid = (int)vars->name[11];
+        matcher_find(matcher, (char *)(vars->val).string, vars->val_len, foundPid, &pid);
+    }
+
+    return 0;
+}
+
+/*
+ * checkTop : the N processes (or names) using the most memory (-N)
+ *
+ *	hrSWRunName and hrSWRunPerfMem are walked together : each request
+ *	gets the name and the memory of the same PIDs.
+ *
+ *	return : Nagios code
+ */
+
+int checkTop(netsnmp_session *ss)
+{
+    netsnmp_pdu *response;
+    netsnmp_variable_list *vars, *row[TOP_WALK_COLUMNS];
+    oid names[TOP_WALK_COLUMNS][MAX_OID_LEN];
+    oid *pnames[TOP_WALK_COLUMNS] = { names[0], names[1] };
+    size_t names_length[TOP_WALK_COLUMNS];
+    oid root[] = { 1, 3, 6, 1, 2, 1, 25 };
+    size_t rootlen = sizeof(objid_mib) / sizeof(oid);
+    t_top top;
+    t_topentry entry;
+    oid lastindex = 0, previndex;
+    size_t length;
+    int count, aligned, incolumn, first, running = 1, exitstatus = OK;
+
+    memset(&top, 0, sizeof(top));
+    top.heap = malloc(topn * sizeof(t_topentry));
+    if (topgroup) {
+        top.groups = malloc(TOP_GROUPS_MAX * sizeof(t_topentry));
+        for (count = 0; count < 2 * TOP_GROUPS_MAX; count++)
+            top.buckets[count] = -1;
+    }
+
+    memmove(names[0], objid_mib, sizeof(objid_mib));
+    memmove(names[1], ram_mib, sizeof(ram_mib));
+    names_length[0] = names_length[1] = rootlen;
+
+    stats_phase("walk");
+    while (running) {
+        if ((response = getNextColumns(pnames, names_length, TOP_WALK_COLUMNS, root, sizeof(root) / sizeof(oid),
+                                       ss)) == NULL) {
+            printf("SNMP Error: timeout\n");
+            free(top.heap);
+            free(top.groups);
+            return UNKNOWN;
+        }
+
+        if (response->errstat != SNMP_ERR_NOERROR) {
+            printf("Error in response");
+            snmp_free_pdu(response);
+            free(top.heap);
+            free(top.groups);
+            return UNKNOWN;
+        }
+
+        previndex = lastindex;
+
+        /* One row = hrSWRunName.<pid>, hrSWRunPerfMem.<pid> */
+        for (vars = response->variables, first = 1; vars && running; first = 0) {
+            for (count = 0; count < TOP_WALK_COLUMNS && vars; count++, vars = vars->next_variable)
+                row[count] = vars;
+
+            /* End of hrSWRunName */
+            if (row[0]->name_length != rootlen + 1 || memcmp(objid_mib, row[0]->name, sizeof(objid_mib)) != 0 ||
+                row[0]->type != ASN_OCTET_STR) {
+                running = 0;
+                break;
+            }
+
+            /* Row cut by the agent (message size, RFC 3416 4.2.3) : asked again */
+            if (count < TOP_WALK_COLUMNS)
+                break;
+
+            /* Memory of the same PID */
+            incolumn = row[1]->name_length == rootlen + 1 && !memcmp(ram_mib, row[1]->name, sizeof(ram_mib));
+            aligned = incolumn && row[1]->name[rootlen] == row[0]->name[rootlen];
+
+            /*
+             * A hole in a column shifts the next rows of the response : they
+             * are asked again, from the last complete row. In the first row
+             * of a response, the hole is real : a PID without name is
+             * skipped, a PID without memory too, and the walk goes on.
+             */
+            if (!aligned && !first)
+                break;
+
+            lastindex = row[0]->name[rootlen];
+            if (incolumn && row[1]->name[rootlen] < lastindex)
+                lastindex = row[1]->name[rootlen];
+
+            if (verbose) {
+                for (count = 0; count < TOP_WALK_COLUMNS; count++)
+                    print_variable(row[count]->name, row[count]->name_length, row[count]);
+            }
+
+            if (!aligned)
+                break;
+            if (row[1]->type != ASN_INTEGER)
+                continue;
+
+            /* Only the processes of -m */
+            if (procnbr > 0 && !matcher_find(matcher, (char *)row[0]->val.string, row[0]->val_len, NULL, NULL))
+                continue;
+
+            length = row[0]->val_len < PROC_NAME_MAX ? row[0]->val_len : PROC_NAME_MAX;
+            memcpy(entry.name, row[0]->val.string, length);
+            entry.name[length] = '\0';
+            entry.pid = lastindex;
+            entry.mem = *(row[1]->val).integer;
+            entry.error = 0;
+
+            if (topgroup)
+                topGroup(&top, entry.name, entry.mem);
+            else
+                topPush(&top, &entry);
+        }
+
+        snmp_free_pdu(response);
+
+        /* No progress (not even one row fits in a response) : the top of a
+         * part of the table would be wrong */
+        if (running && lastindex == previndex) {
+            printf("Error in response: no complete row of hrSWRunTable\n");
+            free(top.heap);
+            free(top.groups);
+            return UNKNOWN;
+        }
+
+        /* Next rows : both columns restart after the last row */
+        for (count = 0; count < TOP_WALK_COLUMNS; count++) {
+            names[count][rootlen] = lastindex;
+            names_length[count] = rootlen + 1;
+        }
+    }
+
+    stats_phase("output");
+    if (topgroup) {
+        for (count = 0; count < top.ngroups; count++)
+            topPush(&top, &top.groups[count]);
+        free(top.groups);
+    }
+
+    /* Biggest first */
+    qsort(top.heap, top.nheap, sizeof(t_topentry), top_cmp);
+
+    for (count = 0; count < top.nheap; count++) {
+        if (top.heap[count].mem / 1024 > rammin)
+            exitstatus = critmem ? CRITICAL : WARNING;
+    }
+
+    /* Summary | perfdata, then one line per process (long output) */
+    printf("%s : top %d %s by memory", exitstatus == OK ? "OK" : exitstatus == WARNING ? "WARNING" : "CRITICAL",
+           top.nheap, topgroup ? "names" : "processes");
+    if (top.nheap > 0)
+        printf(", %s %.2f MB", top.heap[0].name, top.heap[0].mem / 1024.0);
+    printf(" |");
+    for (count = 0; count < top.nheap; count++) {
+        for (length = 0; top.heap[count].name[length]; length++) {
+            if (top.heap[count].name[length] == '\'' || top.heap[count].name[length] == '=')
+                top.heap[count].name[length] = '_';
+        }
+        if (topgroup)
+            printf(" '%s'=%ldKB", top.heap[count].name, top.heap[count].mem);
+        else
+            printf(" '%s[%d]'=%ldKB", top.heap[count].name, top.heap[count].pid, top.heap[count].mem);
+        if (rammin != 9999)
+            printf(";%d", rammin * 1024);
+    }
+    printf("\n");
+
+    for (count = 0; count < top.nheap; count++) {
+        if (topgroup && top.heap[count].error > 0)
+            printf("%s (%d processes or more) : %.2f to %.2f MB, estimated (more than %d names)\n",
+                   top.heap[count].name, top.heap[count].pid, (top.heap[count].mem - top.heap[count].error) / 1024.0,
+                   top.heap[count].mem / 1024.0, TOP_GROUPS_MAX);
+        else if (topgroup)
+            printf("%s (%d processes) : %.2f MB\n", top.heap[count].name, top.heap[count].pid,
+                   top.heap[count].mem / 1024.0);
+        else
+            printf("%s (PID %d) : %.2f MB\n", top.heap[count].name, top.heap[count].pid, top.heap[count].mem / 1024.0);
+    }
+
+    free(top.heap);
+
+    return exitstatus;
+}
+
+/*
+ * topPush : keep an entry if it is one of the N biggest (min-heap : the
+ *	     smallest of the N is on top)
+ */
+
+void topPush(t_top *top, const t_topentry *entry)
+{
+    t_topentry *heap = top->heap, tmp;
+    int pos, child;
+
+    if (top->nheap < topn) {
+        /* Sift up */
+        for (pos = top->nheap++; pos > 0 && heap[(pos - 1) / 2].mem > entry->mem; pos = (pos - 1) / 2)
+            heap[pos] = heap[(pos - 1) / 2];
+        heap[pos] = *entry;
+        return;
+    }
+
+    if (entry->mem <= heap[0].mem)
+        return;
+
+    /* Replace the smallest, sift down */
+    heap[0] = *entry;
+    for (pos = 0; (child = 2 * pos + 1) < top->nheap; pos = child) {
+        if (child + 1 < top->nheap && heap[child + 1].mem < heap[child].mem)
+            child++;
+        if (heap[pos].mem <= heap[child].mem)
+            break;
+        tmp = heap[pos];
+        heap[pos] = heap[child];
+        heap[child] = tmp;
+    }
+}
+
+/*
+ * topGroup : add the memory of a process to its name (-G)
+ */
+
+void topGroup(t_top *top, const char *name, long mem)
+{
+    t_topentry *group;
+    unsigned int hash = 5381;
+    const char *p;
+    int bucket, index, *link, min;
+
+    for (p = name; *p; p++)
+        hash = hash * 33 + (unsigned char)*p;
+    bucket = hash % (2 * TOP_GROUPS_MAX);
+
+    for (index = top->buckets[bucket]; index >= 0; index = top->groups[index].next) {
+        if (!strcmp(top->groups[index].name, name)) {
+            top->groups[index].pid++;
+            top->groups[index].mem += mem;
+            return;
+        }
+    }
+
+    if (top->ngroups < TOP_GROUPS_MAX) {
+        group = &top->groups[top->ngroups];
+        group->mem = 0;
+        group->error = 0;
+        index = top->ngroups++;
+    } else {
+        /* Table full : the smallest name is replaced (space saving) */
+        for (min = 0, index = 1; index < TOP_GROUPS_MAX; index++) {
+            if (top->groups[index].mem < top->groups[min].mem)
+                min = index;
+        }
+        group = &top->groups[min];
+        index = min;
+
+        /* Out of its bucket */
+        for (p = group->name, hash = 5381; *p; p++)
+            hash = hash * 33 + (unsigned char)*p;
+        for (link = &top->buckets[hash % (2 * TOP_GROUPS_MAX)]; *link != index; link = &top->groups[*link].next);
+        *link = group->next;
+
+        /* Its memory may belong to the new name : at most all of it */
+        group->error = group->mem;
+    }
+
+    strcpy(group->name, name);
+    group->pid = 1;
+    group->mem += mem;
+    group->next = top->buckets[bucket];
+    top->buckets[bucket] = index;
+}
+
+/*
+ * top_cmp : qsort order of the top entries (biggest first)
+ */
+
+int top_cmp(const void *a, const void *b)
+{
+    const t_topentry *ta = a, *tb = b;
+
+    return (ta->mem < tb->mem) - (ta->mem > tb->mem);
+}
@@ -18,33 +18,142 @@
     Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
 */
 
-int perfdata = 0;
-int verbose = 0;
-int warnzero = 0;
-int critmem = 0;
-int rammin = 9999;
+static int perfdata = 0;
+static int verbose = 0;
+static int warnzero = 0;
+static int critmem = 0;
+static int rammin = 9999;
+static int cache_age = 0;
+static int cpuwarn = -1;
+static int cpucrit = -1;
+static int topn = 0;
+static int topgroup = 0;
 
 typedef struct process {
     int *index;
-    unsigned char procstr[20];
+    char *procstr;
     int nbr;
     int ram;
-    int cpu;
+    double cpu;                 // CPU % since the last run (-U), -1 if unknown
 
 } t_process;
 
-t_process *process;
+static t_process *process;
 
-const oid objid_mib[] = { 1, 3, 6, 1, 2, 1, 25, 4, 2, 1, 2 };
+/* Names of -m, how they match hrSWRunName (-M) */
+static t_matcher *matcher;
+static int matchmode = MATCH_EXACT;
 
-int warningmin = -1;
-int criticalmin = -1;
+/* A value of hrSWRunName, and if it matches a given process */
+typedef struct procmatch {
+    t_process *proc;
+    int found;
+} t_procmatch;
 
-int procnbr = 0;
+static const oid objid_mib[] = { 1, 3, 6, 1, 2, 1, 25, 4, 2, 1, 2 };
+/* hrSWRunPerfMem */
+static const oid ram_mib[] = { 1, 3, 6, 1, 2, 1, 25, 5, 1, 1, 2 };
+/* hrSWRunPerfCPU */
+static const oid cpu_mib[] = { 1, 3, 6, 1, 2, 1, 25, 5, 1, 1, 1 };
 
-void usage(void);
-int checkProc(netsnmp_session * ss);
-t_process *newProcessEntry(int index_process, t_process * process,
-                           u_char * descr, size_t descr_length, int ram, int cpu);
+/* Max size of hrSWRunName */
+#define PROC_NAME_MAX 64
 
-int check_and_print(netsnmp_session * ss, int procnbr);
+/* A PID found, and the process it belongs to */
+typedef struct pidref {
+    int pid;
+    t_process *proc;
+    long cpu;                   // hrSWRunPerfCPU (centi-seconds), -1 if unknown
+    long long cpu_ms;           // when it was got (ms since the epoch)
+    char name[PROC_NAME_MAX + 1];       // hrSWRunName, to detect a PID reused
+} t_pidref;
+
+/* Objects got for each PID : hrSWRunPerfMem, and with -U hrSWRunPerfCPU
+ * and hrSWRunName
+ */
+typedef struct perf {
+    t_pidref *pids;
+    int columns;
+} t_perf;
+
+#define PERF_COLUMNS_CPU 3
+
+/* CPU counters older than CPU_STATE_AGE seconds are not used */
+#define CPU_STATE_AGE 86400
+
+/* Mean size of an hrSWRunPerfMem value */
+#define RAM_VALUE_SIZE 6
+
+static int warningmin = -1;
+static int criticalmin = -1;
+
+static int procnbr = 0;
+
+int check_snmp_process_main(int argc, char *argv[]);
+static void usage(void);
+static int checkHost(char *hostname, void *ctx);
+static int checkProc(netsnmp_session * ss);
+
+static int matchProcess(netsnmp_variable_list * vars, t_process * proc);
+static void foundProcess(void *data, void *ctx);
+static void foundPid(void *data, void *ctx);
+static int foundName(int root, netsnmp_variable_list * vars, void *ctx);
+static void addProcessIndex(t_process * proc, int pid);
+
+static int check_and_print(netsnmp_session * ss, int procnbr);
+static int getProcessPerf(netsnmp_session * ss, int procnbr);
+static size_t perf_oid(int item, oid * name, void *ctx);
+static void perf_value(int item, netsnmp_variable_list * vars, void *ctx);
+static void processCpu(netsnmp_session * ss, t_pidref * pids, int total);
+static int pidref_cmp(const void *a, const void *b);
+static void stateKind(const char *prefix, char *kind, size_t size);
+static int name_cmp(const void *a, const void *b);
+
+/* State file names of a set of processes : PREFIX-HASH */
+#define STATE_KIND_MAX 16
+
+/* PID cache (-I) : PIDs found by the last walk, checked by a GET of their
+ * hrSWRunName
+ */
+typedef struct pid_cache {
+    t_pidref *pids;
+    int changed;
+} t_pid_cache;
+
+/* Mean size of an hrSWRunName value */
+#define NAME_VALUE_SIZE 16
+
+static int readPidCache(netsnmp_session * ss);
+static void writePidCache(netsnmp_session * ss);
+static size_t name_oid(int item, oid * name, void *ctx);
+static void name_value(int item, netsnmp_variable_list * vars, void *ctx);
+
+/* Top-N mode (-N) : the N processes (or names with -G) using the most
+ * memory, found in one walk of hrSWRunName and hrSWRunPerfMem with a
+ * bounded memory : a min-heap of N entries, and up to TOP_GROUPS_MAX names
+ * (beyond, the smallest name is replaced : the new name inherits its memory,
+ * kept as the error of the new one, which is printed as an estimate)
+ */
+#define TOP_GROUPS_MAX 1024
+#define TOP_WALK_COLUMNS 2
+
+typedef struct topentry {
+    char name[PROC_NAME_MAX + 1];
+    int pid;                    // -G : number of processes
+    long mem;                   // KB
+    long error;                 // -G : KB of the names replaced, in mem
+    int next;                   // -G : next name of the hash bucket
+} t_topentry;
+
+typedef struct top {
+    t_topentry *heap;
+    int nheap;
+    t_topentry *groups;
+    int ngroups;
+    int buckets[2 * TOP_GROUPS_MAX];
+} t_top;
+
+static int checkTop(netsnmp_session * ss);
+static void topPush(t_top * top, const t_topentry * entry);
+static void topGroup(t_top * top, const char *name, long mem);
+static int top_cmp(const void *a, const void *b);
@@ -0,0 +1,249 @@
+/*
+	check_snmpd . Daemon running the Nagios snmp plugins
+
+	Copyright (C) 2006  Vincent GERARD v.ge@wanadoo.fr
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; see the file COPYING. If not, write to the
+	Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include <net-snmp/net-snmp-config.h>
+#include <net-snmp/net-snmp-includes.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <signal.h>
+
+#include "snmp-common.h"
+#include "check_snmpd.h"
+
+/* The plugins served */
+static const struct {
+    const char *name;
+    int (*main)(int argc, char *argv[]);
+} plugins[] = {
+    { "check_snmp_disk", check_snmp_disk_main },
+    { "check_snmp_process", check_snmp_process_main },
+    { "check_snmp_load", check_snmp_load_main },
+    { NULL, NULL }
+};
+
+static int verbose = 0;
+
+static void usage(void)
+{
+    fprintf(stderr, "USAGE: check_snmpd [-S SOCKET] [-c INTEGER] [-v]\n\n");
+    fprintf(stderr,
+            " Run check_snmp_disk, check_snmp_process and check_snmp_load for the\n"
+            " clients (check_snmp_client) connected on a Unix socket. The daemon\n"
+            " initializes the SNMP library once : each check only costs a fork.\n\n"
+            " Options :\n"
+            "  -S SOCKET\tSocket path (default $" DAEMON_SOCKET_ENV " or " DAEMON_SOCKET ")\n"
+            "  -c INTEGER\tMax number of checks running at the same time (64 by default)\n"
+            "  -v \t\tLog each request on stderr\n"
+            "  -h -?\t\tPrint this help\n" "  -V \t\tPrint Version\n");
+}
+
+/*
+ * read_request : read the plugin name and its arguments
+ *
+ *	args : fd = client socket, buf / size = where the request is read,
+ *	       argv = where the pointers to the strings are set (max argc_max)
+ *
+ * return : argc, or -1 if the request is invalid
+ */
+
+static int read_request(int fd, char *buf, size_t size, char **argv, int argc_max)
+{
+    size_t len = 0, start;
+    ssize_t n;
+    int argc = 0;
+
+    /* Read up to the empty string */
+    while (len < 2 || buf[len - 1] != '\0' || buf[len - 2] != '\0') {
+        if (len == size)
+            return -1;
+        if ((n = read(fd, buf + len, size - len)) < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        len += n;
+    }
+
+    for (start = 0; start < len - 1 && buf[start] != '\0'; start += strlen(buf + start) + 1) {
+        if (argc == argc_max)
+            return -1;
+        argv[argc++] = buf + start;
+    }
+    argv[argc] = NULL;
+
+    return argc;
+}
+
+/*
+ * serve : run the request of a client (in a child of the daemon)
+ *
+ *	The plugin runs in one more child, its stdout and stderr going to the
+ *	client : it can exit() anywhere, we still send its exit code.
+ */
+
+static void serve(int fd)
+{
+    static char buf[DAEMON_REQUEST_MAX];
+    static char *argv[DAEMON_REQUEST_MAX / 2 + 1];
+    unsigned char trailer[2];
+    int argc, count, status;
+    pid_t pid;
+
+    trailer[0] = '\0';
+    trailer[1] = UNKNOWN;
+
+    if ((argc = read_request(fd, buf, sizeof(buf), argv, DAEMON_REQUEST_MAX / 2)) < 1) {
+        dprintf(fd, "UNKNOWN: invalid request");
+    } else {
+        for (count = 0; plugins[count].name; count++) {
+            if (!strcmp(argv[0], plugins[count].name))
+                break;
+        }
+
+        if (verbose)
+            fprintf(stderr, "check_snmpd: %s (%d arguments)\n", argv[0], argc - 1);
+
+        if (plugins[count].name == NULL) {
+            dprintf(fd, "UNKNOWN: check_snmpd doesn't run %s", argv[0]);
+        } else if ((pid = fork()) == 0) {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            close(fd);
+            optind = 1;
+            exit(plugins[count].main(argc, argv));
+        } else if (pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status)) {
+            trailer[1] = WEXITSTATUS(status);
+        }
+    }
+
+    write(fd, trailer, sizeof(trailer));
+    close(fd);
+}
+
+/*
+ * main function : -> parse command line args
+ *		   -> initialize the SNMP library
+ *		   -> accept the clients, one child per request
+ */
+
+int main(int argc, char *argv[])
+{
+    struct sockaddr_un addr;
+    const char *path = getenv(DAEMON_SOCKET_ENV);
+    int opt, listenfd, fd, children = 0, maxchildren = DAEMON_CHILDREN_DEFAULT;
+    pid_t pid;
+
+    while ((opt = getopt(argc, argv, "?hVvS:c:")) != -1) {
+        switch (opt) {
+        case '?':
+        case 'h':
+            usage();
+            exit(UNKNOWN);
+
+        case 'V':
+            print_version();
+            exit(UNKNOWN);
+
+        case 'v':
+            verbose = 1;
+            break;
+
+        case 'S':
+            path = optarg;
+            break;
+
+        case 'c':
+            if (!is_integer(optarg) || atoi(optarg) < 1) {
+                printf("Max number of checks (%s) must be a positive integer!\n", optarg);
+                exit(UNKNOWN);
+            }
+            maxchildren = atoi(optarg);
+            break;
+        }
+    }
+
+    if (path == NULL || *path == '\0')
+        path = DAEMON_SOCKET;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("Socket path too long : %s\n", path);
+        exit(UNKNOWN);
+    }
+
+    /* What each check would do on its own, done once */
+    init_snmp("check_snmp");
+    SOCK_STARTUP;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Socket only usable by the user running the daemon (and root) */
+    umask(077);
+    if (!strcmp(path, DAEMON_SOCKET))
+        mkdir(STATE_DIR, 0700);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    if ((listenfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+        bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listenfd, 128) != 0) {
+        printf("Can't listen on %s : %s\n", path, strerror(errno));
+        exit(UNKNOWN);
+    }
+
+    if (verbose)
+        fprintf(stderr, "check_snmpd: listening on %s\n", path);
+
+    for (;;) {
+        /* Reap the finished requests, wait if too many are running */
+        while (children > 0 && (pid = waitpid(-1, NULL, children >= maxchildren ? 0 : WNOHANG)) != 0) {
+            if (pid < 0 && errno == EINTR)
+                continue;
+            if (pid < 0)
+                children = 0;
+            else
+                children--;
+        }
+
+        if ((fd = accept(listenfd, NULL, NULL)) < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            printf("accept : %s\n", strerror(errno));
+            break;
+        }
+
+        if ((pid = fork()) == 0) {
+            close(listenfd);
+            serve(fd);
+            _exit(0);
+        }
+
+        if (pid > 0)
+            children++;
+
+        close(fd);
+    }
+
+    SOCK_CLEANUP;
+
+    return UNKNOWN;
+}
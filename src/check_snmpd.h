@@ -0,0 +1,36 @@
+/*
+    check_snmpd . Daemon running the Nagios snmp plugins, and its client
+
+    Copyright (C) 2006  Vincent GERARD v.ge@wanadoo.fr
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; see the file COPYING. If not, write to the
+    Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * Protocol, on a Unix stream socket :
+ *   request  : plugin name, then its arguments, each one ended by '\0',
+ *		and an empty string at the end
+ *   response : output of the plugin (stdout and stderr), then '\0' and
+ *		one byte : the exit code of the plugin
+ */
+
+#define DAEMON_SOCKET "/var/tmp/check_snmp/check_snmpd.sock"
+#define DAEMON_SOCKET_ENV "CHECK_SNMPD_SOCKET"
+#define DAEMON_REQUEST_MAX 65536
+#define DAEMON_CHILDREN_DEFAULT 64
+
+int check_snmp_disk_main(int argc, char *argv[]);
+int check_snmp_process_main(int argc, char *argv[]);
+int check_snmp_load_main(int argc, char *argv[]);
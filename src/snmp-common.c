@@ -24,7 +24,7 @@
 #include <limits.h>
 #include "snmp-common.h"
 
-#define VERSION "1.3"
+#define VERSION "1.4"
 
 void print_version(void)
 {
@@ -33,6 +33,38 @@ void print_version(void)
          VERSION);
 }
 
+/*
+ * snmp_startup : initialize the SNMP library (instead of init_snmp)
+ *
+ * The plugins only use numeric OIDs : the MIB files are needed only to
+ * print the names of the variables in verbose mode. Without -v, the MIBs
+ * are not read, which is most of the startup time. snmp.conf is read (it
+ * may set the defaults of the sessions), unless CHECK_SNMP_NOCONFIG is set :
+ * then neither snmp.conf nor the persistent files of net-snmp are read (nor
+ * the persistent files written at exit).
+ *
+ *	args : type = application name (for the config files)
+ *	       verbose = MIBs read if set
+ */
+
+void snmp_startup(const char *type, int verbose)
+{
+    const char *noconfig = getenv(NOCONFIG_ENV);
+
+    if (!verbose) {
+        setenv("MIBS", "", 1);
+        setenv("MIBDIRS", "", 1);
+    }
+
+    if (noconfig != NULL && *noconfig != '\0' && strcmp(noconfig, "0") != 0) {
+        netsnmp_ds_set_boolean(NETSNMP_DS_LIBRARY_ID, NETSNMP_DS_LIB_DONT_READ_CONFIGS, 1);
+        netsnmp_ds_set_boolean(NETSNMP_DS_LIBRARY_ID, NETSNMP_DS_LIB_DISABLE_PERSISTENT_LOAD, 1);
+        netsnmp_ds_set_boolean(NETSNMP_DS_LIBRARY_ID, NETSNMP_DS_LIB_DISABLE_PERSISTENT_SAVE, 1);
+    }
+
+    init_snmp(type);
+}
+
 void init_v3_args(snmpv3_args_t *v3_args)
 {
     memset(v3_args, 0, sizeof(snmpv3_args_t));
@@ -122,8 +154,8 @@ void snmpv3_set_session(netsnmp_session *session, const snmpv3_args_t *v3args)
     }
 
     session->securityAuthKeyLen = USM_AUTH_KU_LEN;
-    kuret = generate_Ku(session->securityAuthProto, session->securityAuthProtoLen, (unsigned char *)v3args->password,
-                        strlen(v3args->password), session->securityAuthKey, &(session->securityAuthKeyLen));
+    kuret = snmpv3_generate_Ku(session->securityAuthProto, session->securityAuthProtoLen, v3args->password,
+                               session->securityAuthKey, &(session->securityAuthKeyLen));
 
     if (kuret != SNMPERR_SUCCESS) {
         printf("Error generating SNMP Authentication Key from the passphrase\n");
@@ -140,10 +172,8 @@ void snmpv3_set_session(netsnmp_session *session, const snmpv3_args_t *v3args)
             exit(UNKNOWN);
         }
         session->securityPrivKeyLen = USM_PRIV_KU_LEN;
-        kuret =
-            generate_Ku(session->securityAuthProto, session->securityAuthProtoLen,
-                        (unsigned char *)v3args->priv_password, strlen(v3args->priv_password), session->securityPrivKey,
-                        &(session->securityPrivKeyLen));
+        kuret = snmpv3_generate_Ku(session->securityAuthProto, session->securityAuthProtoLen, v3args->priv_password,
+                                   session->securityPrivKey, &(session->securityPrivKeyLen));
 
         if (kuret != SNMPERR_SUCCESS) {
             printf("Error generating SNMP Privacy Key from the passphrase\n");
@@ -194,7 +224,7 @@ netsnmp_pdu *getResponse(oid *nameoid, size_t nameoid_length, netsnmp_session *p
     /*
      * do the request
      */
-    status = snmp_synch_response(pss, pdu, &response);
+    status = snmp_synch_request(pss, pdu, &response);
     if (status == STAT_SUCCESS) {
 
         return response;
@@ -265,3 +295,617 @@ int snmp_get_int(netsnmp_session *ss, oid *theoid, size_t theoid_len)
     }
     return retvalue;
 }
+
+/*
+ * snmp_get_uptime : sysUpTime of the agent (hundredths of seconds since it
+ *		     started)
+ *
+ * return : sysUpTime, or -1 on error
+ */
+
+long snmp_get_uptime(netsnmp_session *ss)
+{
+    oid sysuptime[] = { 1, 3, 6, 1, 2, 1, 1, 3, 0 };
+    netsnmp_pdu *response;
+    long uptime = -1;
+
+    if ((response = getResponse(sysuptime, sizeof(sysuptime) / sizeof(oid), ss, SNMP_MSG_GET)) != NULL) {
+        if (response->errstat == SNMP_ERR_NOERROR && response->variables->type == ASN_TIMETICKS)
+            uptime = *(response->variables->val).integer;
+        snmp_free_pdu(response);
+    }
+
+    return uptime;
+}
+
+/*
+ * GETBULK state of the current peer :
+ *   reps    = varbinds to ask in the next request (max-repetitions x columns)
+ *   ceiling = highest value known to work (0 = not known yet)
+ */
+static struct {
+    char *peer;
+    int reps;
+    int ceiling;
+} bulk = { NULL, BULK_REPS_DEFAULT, 0 };
+
+static void bulk_load(const char *peer)
+{
+    FILE *fp;
+
+    if (bulk.peer && !strcmp(bulk.peer, peer))
+        return;
+
+    free(bulk.peer);
+    bulk.peer = strdup(peer);
+    bulk.reps = BULK_REPS_DEFAULT;
+    bulk.ceiling = 0;
+
+    if ((fp = state_open_read(peer, "bulk")) != NULL) {
+        if (fscanf(fp, "%d %d", &bulk.reps, &bulk.ceiling) != 2 || bulk.reps < 1 || bulk.reps > BULK_REPS_MAX) {
+            bulk.reps = BULK_REPS_DEFAULT;
+            bulk.ceiling = 0;
+        }
+        fclose(fp);
+    }
+}
+
+static void bulk_save(void)
+{
+    FILE *fp;
+
+    if ((fp = state_open_write(bulk.peer, "bulk")) != NULL) {
+        fprintf(fp, "%d %d\n", bulk.reps, bulk.ceiling);
+        state_close_write(fp, bulk.peer, "bulk");
+    }
+}
+
+/* getNextResponse
+ * args :  *nameoid / nameoid_length = last oid got (or root at the beginning)
+ *	    *rootoid / rootoid_length = root of the subtree walked
+ *	    *pss =  SNMP session pointer
+ *
+ * Get the objects following nameoid, to walk the SNMP tree :
+ *   - SNMP v1 : one GETNEXT, so one object per request
+ *   - SNMP v2c/v3 : one GETBULK, so many objects per request
+ *
+ * The caller must walk all the varbinds of the response, and stop at the
+ * first one which is not in its subtree.
+ *
+ * return :	*response : pdu pointer or NULL if error
+ */
+netsnmp_pdu *getNextResponse(oid *nameoid, size_t nameoid_length, oid *rootoid, size_t rootoid_length,
+                             netsnmp_session *pss)
+{
+    return getNextColumns(&nameoid, &nameoid_length, 1, rootoid, rootoid_length, pss);
+}
+
+/*
+ * bulk_adapt : max-repetitions of the peer after a response to a GETBULK
+ *		of asked varbinds
+ *
+ * A full response of objects of the subtree : bigger requests are tried.
+ * A response with fewer varbinds than asked, not ended by the MIB view, was
+ * truncated by the agent to fit in its message size : the ceiling of the
+ * peer is what it sent. A full response which ran past the end of the
+ * subtree is not truncated : the table was just shorter than asked (it must
+ * not pin the ceiling of the peer to the size of its smallest table).
+ */
+static void bulk_adapt(netsnmp_pdu *response, int asked, const oid *rootoid, size_t rootoid_length)
+{
+    netsnmp_variable_list *vars, *last = NULL;
+    int count;
+
+    for (count = 0, vars = response->variables; vars; vars = vars->next_variable, count++)
+        last = vars;
+
+    if (count == 0)
+        return;
+
+    if (count == asked && last->name_length >= rootoid_length &&
+        !memcmp(rootoid, last->name, rootoid_length * sizeof(oid))) {
+        if (bulk.reps < BULK_REPS_MAX && (bulk.ceiling == 0 || bulk.reps < bulk.ceiling)) {
+            bulk.reps *= 2;
+            if (bulk.reps > BULK_REPS_MAX)
+                bulk.reps = BULK_REPS_MAX;
+            if (bulk.ceiling && bulk.reps > bulk.ceiling)
+                bulk.reps = bulk.ceiling;
+        }
+    } else if (count < asked && last->type != SNMP_ENDOFMIBVIEW && last->type != SNMP_NOSUCHOBJECT &&
+               last->type != SNMP_NOSUCHINSTANCE) {
+        bulk.reps = bulk.ceiling = count;
+    }
+}
+
+/* getNextColumns
+ * args :  **names / *names_length = last oid got in each column walked
+ *	    ncolumns = number of columns
+ *	    *rootoid / rootoid_length = root of the table walked
+ *	    *pss =  SNMP session pointer
+ *
+ * Walk several columns of a table in lockstep : the request has one varbind
+ * per column, the response has one row (GETNEXT in SNMP v1) or several
+ * rows (GETBULK) of ncolumns varbinds.
+ *
+ * max-repetitions is adapted to the peer : halved when the agent answers
+ * tooBig, lowered to what the agent really sent when it truncated the
+ * response, and doubled (up to the known ceiling) when a response was full
+ * of objects of the table. The best value is saved for the next run.
+ *
+ * return :	*response : pdu pointer or NULL if error
+ */
+netsnmp_pdu *getNextColumns(oid **names, size_t *names_length, int ncolumns, oid *rootoid, size_t rootoid_length,
+                            netsnmp_session *pss)
+{
+    netsnmp_pdu *pdu, *response;
+    int status, count, reps, oldreps;
+
+    /* Subtrees prefetched by check_snmp */
+    if ((response = prefetch_next(names, names_length, ncolumns)) != NULL)
+        return response;
+
+    if (pss->version == SNMP_VERSION_1 || pss->peername == NULL) {
+        pdu = snmp_pdu_create(SNMP_MSG_GETNEXT);
+        for (count = 0; count < ncolumns; count++)
+            snmp_add_null_var(pdu, names[count], names_length[count]);
+
+        status = snmp_synch_request(pss, pdu, &response);
+        return status == STAT_SUCCESS ? response : NULL;
+    }
+
+    bulk_load(pss->peername);
+    oldreps = bulk.reps;
+
+    for (;;) {
+        reps = bulk.reps / ncolumns > 0 ? bulk.reps / ncolumns : 1;
+
+        pdu = snmp_pdu_create(SNMP_MSG_GETBULK);
+        pdu->non_repeaters = 0;
+        pdu->max_repetitions = reps;
+        for (count = 0; count < ncolumns; count++)
+            snmp_add_null_var(pdu, names[count], names_length[count]);
+
+        status = snmp_synch_request(pss, pdu, &response);
+        if (status != STAT_SUCCESS)
+            return NULL;
+
+        /* Response too big for the agent : ask for less */
+        if (response->errstat == SNMP_ERR_TOOBIG && reps > 1) {
+            bulk.reps = reps * ncolumns / 2;
+            bulk.ceiling = bulk.reps;
+            snmp_free_pdu(response);
+            continue;
+        }
+        break;
+    }
+
+    if (response->errstat == SNMP_ERR_NOERROR)
+        bulk_adapt(response, reps * ncolumns, rootoid, rootoid_length);
+
+    if (bulk.reps != oldreps)
+        bulk_save();
+
+    return response;
+}
+
+/*
+ * snmp_walk : walk one or several subtrees, giving each object to visit()
+ *
+ *	The subtrees are walked together : each request has one varbind per
+ *	subtree not finished yet (GETBULK in SNMP v2c/v3). A subtree ends at
+ *	the first object out of it, an exception, or an OID not increasing.
+ *	visit() gets the varbinds of the response, not a copy : it must copy
+ *	what it keeps.
+ *
+ *	args : ss = session, roots / rootlens / nroots = subtrees
+ *	       (WALK_ROOTS_MAX at most)
+ *	       visit(root, vars, ctx) = called for each object, in the order of
+ *					its subtree (root = index in roots).
+ *					Returns 0 to go on, > 0 to stop the
+ *					walk, < 0 on error (out of memory)
+ *	       ctx = given to visit()
+ *
+ * return : 0 if ok (or stopped by visit), WALK_TIMEOUT, WALK_ERROR or
+ *	    WALK_VISIT (error of visit)
+ */
+int snmp_walk(netsnmp_session *ss, const oid **roots, const size_t *rootlens, int nroots, snmp_walk_visit visit,
+              void *ctx)
+{
+    netsnmp_pdu *response;
+    netsnmp_variable_list *vars;
+    oid names[WALK_ROOTS_MAX][MAX_OID_LEN];
+    oid *pnames[WALK_ROOTS_MAX];
+    size_t names_length[WALK_ROOTS_MAX], lengths[WALK_ROOTS_MAX], common;
+    int map[WALK_ROOTS_MAX], done[WALK_ROOTS_MAX];
+    int count, column, nactive, root, ret;
+
+    if (nroots > WALK_ROOTS_MAX)
+        nroots = WALK_ROOTS_MAX;
+
+    for (count = 0; count < nroots; count++) {
+        memmove(names[count], roots[count], rootlens[count] * sizeof(oid));
+        names_length[count] = rootlens[count];
+        done[count] = 0;
+    }
+
+    for (;;) {
+        /* One column per subtree not finished */
+        for (count = 0, nactive = 0; count < nroots; count++) {
+            if (done[count])
+                continue;
+            map[nactive] = count;
+            lengths[nactive] = names_length[count];
+            pnames[nactive++] = names[count];
+        }
+        if (nactive == 0)
+            return 0;
+
+        /* Root of all the columns, for the GETBULK size */
+        for (common = rootlens[map[0]], count = 1; count < nactive; count++) {
+            for (column = 0; column < (int)common && column < (int)rootlens[map[count]] &&
+                 roots[map[count]][column] == roots[map[0]][column]; column++);
+            common = column;
+        }
+
+        if ((response = getNextColumns(pnames, lengths, nactive, (oid *)roots[map[0]], common, ss)) == NULL)
+            return WALK_TIMEOUT;
+
+        if (response->errstat == SNMP_ERR_NOSUCHNAME && response->errindex > 0 && response->errindex <= nactive) {
+            /* SNMP v1 : end of the MIB for this column */
+            done[map[response->errindex - 1]] = 1;
+            snmp_free_pdu(response);
+            continue;
+        }
+
+        if (response->errstat != SNMP_ERR_NOERROR) {
+            snmp_free_pdu(response);
+            return WALK_ERROR;
+        }
+
+        /* Rows of nactive varbinds */
+        for (vars = response->variables, column = 0; vars; vars = vars->next_variable, column = (column + 1) % nactive) {
+            root = map[column];
+            if (done[root])
+                continue;
+
+            if (vars->name_length <= rootlens[root] ||
+                memcmp(roots[root], vars->name, rootlens[root] * sizeof(oid)) ||
+                vars->type == SNMP_ENDOFMIBVIEW || vars->type == SNMP_NOSUCHOBJECT ||
+                vars->type == SNMP_NOSUCHINSTANCE ||
+                snmp_oid_compare(vars->name, vars->name_length, names[root], names_length[root]) <= 0) {
+                done[root] = 1;
+                continue;
+            }
+
+            if ((ret = visit(root, vars, ctx)) != 0) {
+                snmp_free_pdu(response);
+                return ret < 0 ? WALK_VISIT : 0;
+            }
+
+            memmove(names[root], vars->name, vars->name_length * sizeof(oid));
+            names_length[root] = vars->name_length;
+        }
+
+        snmp_free_pdu(response);
+    }
+}
+
+/*
+ * Size of the messages built by snmp_get_batch : small enough to get the
+ * responses in one ethernet frame, halved each time the agent says tooBig.
+ */
+static size_t batch_msgsize = BATCH_MSG_SIZE;
+
+/*
+ * batch_oid_size : encoded size of an OID (BER, 7 bits per byte)
+ */
+static size_t batch_oid_size(const oid *name, size_t name_length)
+{
+    size_t size = 1, i;
+    oid sub;
+
+    for (i = 2; i < name_length; i++) {
+        for (sub = name[i], size++; sub >= 0x80; sub >>= 7)
+            size++;
+    }
+    return size;
+}
+
+/*
+ * Asynchronous requests of snmp_get_batch
+ */
+typedef struct batchreq {
+    int reqid;                  // 0 = free slot
+    int generation;             // discoveries of the engine before it was sent
+    long long sent;             // rtt_start()
+    int nitems;
+    int items[BATCH_VARBINDS_MAX];
+} t_batchreq;
+
+typedef struct batch {
+    netsnmp_session *ss;
+    int count;
+    size_t value_size;
+    snmp_batch_oid getoid;
+    snmp_batch_value setvalue;
+    void *ctx;
+
+    int next;                   // next item never sent
+    int *pending;               // items to send again
+    int npending;
+    int inflight;
+    double cwnd;                // window of outstanding requests (AIMD)
+    int failed;
+    int generation;             // discoveries of the engine done by the batch
+    int report;                 // SNMPv3 report to a request of this generation
+    t_batchreq reqs[ASYNC_WINDOW_MAX];
+} t_batch;
+
+/*
+ * Only one batch at a time : when it fails, answers of its requests may
+ * still come later (during a synchronous request). They match no slot
+ * and are dropped.
+ */
+static t_batch batch;
+
+static int batch_callback(int operation, netsnmp_session * ss, int reqid, netsnmp_pdu * response, void *magic);
+
+/* Max number of outstanding requests (-W) */
+static int async_window = ASYNC_WINDOW_DEFAULT;
+
+void snmp_set_window(int window)
+{
+    if (window < 1)
+        window = 1;
+    if (window > ASYNC_WINDOW_MAX)
+        window = ASYNC_WINDOW_MAX;
+    async_window = window;
+}
+
+/*
+ * batch_requeue : items of a request will be sent again
+ */
+static void batch_requeue(t_batch *batch, const int *items, int nitems)
+{
+    memcpy(batch->pending + batch->npending, items, nitems * sizeof(int));
+    batch->npending += nitems;
+}
+
+/*
+ * batch_send : build a request with the items to send again first, then the
+ *		next ones, as many as the message size allows, and send it
+ *
+ * return : 0 if sent, -1 on error
+ */
+static int batch_send(t_batch *batch, t_batchreq *req)
+{
+    netsnmp_pdu *pdu;
+    oid name[MAX_OID_LEN];
+    size_t name_length, size, varsize;
+    int item;
+
+    pdu = snmp_pdu_create(SNMP_MSG_GET);
+    for (size = 0, req->nitems = 0;
+         req->nitems < BATCH_VARBINDS_MAX && (batch->npending > 0 || batch->next < batch->count);) {
+        item = batch->npending > 0 ? batch->pending[batch->npending - 1] : batch->next;
+        name_length = batch->getoid(item, name, batch->ctx);
+        varsize = batch_oid_size(name, name_length) + batch->value_size + 4;
+        if (req->nitems > 0 && size + varsize > batch_msgsize - BATCH_MSG_HEADER)
+            break;
+
+        snmp_add_null_var(pdu, name, name_length);
+        size += varsize;
+        req->items[req->nitems++] = item;
+
+        if (batch->npending > 0)
+            batch->npending--;
+        else
+            batch->next++;
+    }
+
+    stats_request(pdu);
+    req->generation = batch->generation;
+    req->sent = rtt_start();
+    if ((req->reqid = snmp_async_send(batch->ss, pdu, batch_callback, batch)) == 0) {
+        snmp_free_pdu(pdu);
+        return -1;
+    }
+    batch->inflight++;
+
+    return 0;
+}
+
+/*
+ * batch_callback : response (or timeout) of a request sent by batch_send
+ */
+static int batch_callback(int operation, netsnmp_session *ss, int reqid, netsnmp_pdu *response, void *magic)
+{
+    t_batch *batch = magic;
+    t_batchreq *req = NULL;
+    netsnmp_variable_list *vars;
+    int count;
+
+    for (count = 0; count < ASYNC_WINDOW_MAX; count++) {
+        if (batch->reqs[count].reqid == reqid) {
+            req = &batch->reqs[count];
+            break;
+        }
+    }
+    if (req == NULL || reqid == 0)
+        return 1;
+
+    req->reqid = 0;
+    batch->inflight--;
+
+    if (operation == NETSNMP_CALLBACK_OP_TIMED_OUT) {
+        stats_timeout();
+        rtt_timeout();
+
+        /* Congestion (or slow agent) : halve the window and try again.
+         * With a window of one request, the agent is just not answering.
+         */
+        if (batch->cwnd < 2) {
+            batch->failed = 1;
+        } else {
+            batch->cwnd /= 2;
+            batch_requeue(batch, req->items, req->nitems);
+        }
+        return 1;
+    }
+
+    if (operation != NETSNMP_CALLBACK_OP_RECEIVED_MESSAGE) {
+        batch->failed = 1;
+        return 1;
+    }
+
+    rtt_sample(ss, req->sent);
+
+    /* Answer : one more request in the window (every cwnd answers) */
+    if (batch->cwnd < async_window)
+        batch->cwnd += 1 / batch->cwnd;
+
+    if (response->command == SNMP_MSG_REPORT) {
+        /* SNMPv3 report (unknown engineID, not in time window...) : not the
+         * values. The items are sent again after a new discovery, done by
+         * snmp_get_batch out of the callback. A report to a request sent
+         * after the discovery is an error. */
+        batch_requeue(batch, req->items, req->nitems);
+        if (req->generation == batch->generation)
+            batch->report = 1;
+    } else if (response->errstat == SNMP_ERR_NOERROR) {
+        for (count = 0, vars = response->variables; count < req->nitems; count++) {
+            batch->setvalue(req->items[count], vars, batch->ctx);
+            if (vars)
+                vars = vars->next_variable;
+        }
+    } else if (response->errstat == SNMP_ERR_TOOBIG && req->nitems > 1) {
+        /* Smaller requests, and send these items again */
+        if (batch_msgsize > BATCH_MSG_HEADER * 2)
+            batch_msgsize = (batch_msgsize + BATCH_MSG_HEADER) / 2;
+        batch_requeue(batch, req->items, req->nitems);
+    } else if (response->errstat == SNMP_ERR_NOSUCHNAME && response->errindex > 0 &&
+               response->errindex <= req->nitems && req->nitems > 1) {
+        /* SNMP v1 : one of the objects doesn't exist, ask again for the others */
+        batch->setvalue(req->items[response->errindex - 1], NULL, batch->ctx);
+        batch_requeue(batch, req->items, response->errindex - 1);
+        batch_requeue(batch, req->items + response->errindex, req->nitems - response->errindex);
+    } else {
+        for (count = 0; count < req->nitems; count++)
+            batch->setvalue(req->items[count], NULL, batch->ctx);
+    }
+
+    return 1;
+}
+
+/*
+ * snmp_get_batch : GET a list of objects, with as many varbinds per request
+ *		    as the message size of the agent allows
+ *	args : ss = session
+ *	       count = number of objects (items numbered 0 to count - 1)
+ *	       value_size = expected encoded size of a value, to size the PDUs
+ *	       getoid(item, name, ctx) : write the OID of item in name,
+ *					 return its length
+ *	       setvalue(item, vars, ctx) : called with the varbind got for each
+ *					   item, or vars = NULL if the agent
+ *					   has no value for it (v1 noSuchName,
+ *					   error). v2c exceptions
+ *					   (noSuchInstance...) are given as is.
+ *	       ctx = passed to the callbacks
+ *
+ * The requests are sent asynchronously : up to -W requests are outstanding,
+ * so their round trips overlap. The window is halved on each timeout (the
+ * timed out request is sent again) and grows back by one request per window
+ * of answers (AIMD). A timeout with a window of one request is an error.
+ * An SNMPv3 report (engine of the state file outdated) is answered like
+ * snmp_synch_request does : one new discovery, and the requests sent again.
+ *
+ * return : 0 if ok, -1 on timeout / network error / report
+ */
+int snmp_get_batch(netsnmp_session *ss, int count, size_t value_size, snmp_batch_oid getoid,
+                   snmp_batch_value setvalue, void *ctx)
+{
+    t_batchreq *req;
+    netsnmp_variable_list *vars;
+    oid name[MAX_OID_LEN];
+    size_t name_length;
+    struct timeval timeout;
+    fd_set fdset;
+    int fds, block, slot, ret, item;
+    int pending[BATCH_VARBINDS_MAX];    // small batches (laLoadInt.1-3) : no allocation
+
+    if (count <= 0)
+        return 0;
+
+    memset(&batch, 0, sizeof(batch));
+    batch.ss = ss;
+    batch.count = count;
+    batch.value_size = value_size;
+    batch.getoid = getoid;
+    batch.setvalue = setvalue;
+    batch.ctx = ctx;
+    batch.pending = count <= BATCH_VARBINDS_MAX ? pending : malloc(count * sizeof(int));
+    if (batch.pending == NULL)
+        return -1;
+    batch.cwnd = async_window;
+
+    /* Objects of prefetched subtrees (check_snmp) : only the others are sent */
+    if (prefetch_active()) {
+        for (item = count - 1; item >= 0; item--) {
+            name_length = getoid(item, name, ctx);
+            if (prefetch_get(name, name_length, &vars))
+                setvalue(item, vars, ctx);
+            else
+                batch.pending[batch.npending++] = item;
+        }
+        batch.next = count;
+    }
+
+    while (!batch.failed && (batch.next < count || batch.npending > 0 || batch.inflight > 0)) {
+        /* Fill the window */
+        for (slot = 0; slot < ASYNC_WINDOW_MAX && batch.inflight < (int)batch.cwnd; slot++) {
+            req = &batch.reqs[slot];
+            if (req->reqid != 0)
+                continue;
+            if (batch.next >= count && batch.npending == 0)
+                break;
+            if (batch_send(&batch, req) != 0) {
+                batch.failed = 1;
+                break;
+            }
+        }
+        if (batch.failed || batch.inflight == 0)
+            continue;
+
+        /* Wait for the answers */
+        fds = 0;
+        block = 1;
+        FD_ZERO(&fdset);
+        snmp_select_info(&fds, &fdset, &timeout, &block);
+        fds = select(fds, &fdset, NULL, NULL, block ? NULL : &timeout);
+        if (fds > 0) {
+            snmp_read(&fdset);
+        } else if (fds == 0) {
+            snmp_timeout();
+        } else if (errno != EINTR) {
+            batch.failed = 1;
+        }
+
+        /* Requests of the engine of the state file : discovered again, once */
+        if (batch.report && !batch.failed) {
+            batch.report = 0;
+            if (snmpv3_rediscover(ss))
+                batch.generation++;
+            else
+                batch.failed = 1;
+        }
+    }
+
+    ret = batch.failed ? -1 : 0;
+
+    /* Requests still outstanding (error) are forgotten */
+    if (batch.pending != pending)
+        free(batch.pending);
+    memset(&batch, 0, sizeof(batch));
+
+    return ret;
+}
@@ -40,10 +40,137 @@ void free_v3_args(snmpv3_args_t * v3_args);
 void snmpv3_parseargs(int verbose, int opt, char *optarg, snmpv3_args_t * v3args);
 void snmpv3_set_session(netsnmp_session * session, const snmpv3_args_t * v3args);
 
+/* SNMPv3 key and engine cache (snmp-keys.c) */
+int snmpv3_generate_Ku(const oid * hashtype, u_int hashtype_len, const char *passphrase, u_char * Ku, size_t * kulen);
+int snmpv3_load_keys(netsnmp_session * session);
+void snmpv3_save_keys(netsnmp_session * session, netsnmp_session * ss, int failed);
+int snmpv3_rediscover(netsnmp_session * ss);
+int snmp_synch_request(netsnmp_session * ss, netsnmp_pdu * pdu, netsnmp_pdu ** response);
+
 netsnmp_pdu *getResponse(oid * nameoid, size_t nameoid_length, netsnmp_session * pss, int type);
+netsnmp_pdu *getNextResponse(oid * nameoid, size_t nameoid_length, oid * rootoid, size_t rootoid_length,
+                             netsnmp_session * pss);
+netsnmp_pdu *getNextColumns(oid ** names, size_t * names_length, int ncolumns, oid * rootoid, size_t rootoid_length,
+                            netsnmp_session * pss);
+
+/* Walk of subtrees, each object given to a visitor (see snmp_walk) */
+#define WALK_ROOTS_MAX 16
+#define WALK_TIMEOUT -1
+#define WALK_ERROR -2
+#define WALK_VISIT -3
+
+typedef int (*snmp_walk_visit)(int root, netsnmp_variable_list * vars, void *ctx);
+
+int snmp_walk(netsnmp_session * ss, const oid ** roots, const size_t * rootlens, int nroots, snmp_walk_visit visit,
+              void *ctx);
+
 void snmp_get_uchar(netsnmp_session * ss, oid * theoid, size_t theoid_len, unsigned char *result, size_t length);
 int snmp_get_int(netsnmp_session * ss, oid * theoid, size_t theoid_len);
+long snmp_get_uptime(netsnmp_session * ss);
+
+/* Batched GET (see snmp_get_batch) */
+#define BATCH_MSG_SIZE 1400     // Response should fit in one ethernet frame
+#define BATCH_MSG_HEADER 128    // Message + PDU headers, SNMP v3 included
+#define BATCH_VARBINDS_MAX 64
+
+/* Outstanding requests of snmp_get_batch (-W) */
+#define ASYNC_WINDOW_DEFAULT 4
+#define ASYNC_WINDOW_MAX 32
+
+typedef size_t (*snmp_batch_oid)(int item, oid * name, void *ctx);
+typedef void (*snmp_batch_value)(int item, netsnmp_variable_list * vars, void *ctx);
+
+int snmp_get_batch(netsnmp_session * ss, int count, size_t value_size, snmp_batch_oid getoid,
+                   snmp_batch_value setvalue, void *ctx);
+void snmp_set_window(int window);
 
 int is_integer(char *number);
 
+/* GETBULK size (varbinds per response) : learned per host, kept in the state directory */
+#define BULK_REPS_DEFAULT 10
+#define BULK_REPS_MAX 100
+
+/* Many hosts in one run (snmp-fanout.c) */
+#define FANOUT_DEFAULT 16
+
+int snmp_hostlist(char *arg, char ***hostsp);
+int snmp_fanout(char **hosts, int nhosts, int parallel, const char *statusfile,
+                int (*check)(char *host, void *ctx), void *ctx);
+int snmp_worst(int code1, int code2);
+
+/* Persistent per host state (snmp-state.c) */
+#define STATE_DIR "/var/tmp/check_snmp"
+#define STATE_DIR_ENV "CHECK_SNMP_STATEDIR"
+
+FILE *state_open_read(const char *peer, const char *kind);
+FILE *state_open_write(const char *peer, const char *kind);
+int state_close_write(FILE * fp, const char *peer, const char *kind);
+void state_remove(const char *peer, const char *kind);
+
+/* Name matching (snmp-match.c), case ignored */
+#define MATCH_EXACT 0           // the whole name
+#define MATCH_PREFIX 1          // the names beginning with it
+#define MATCH_PATTERN 2         // names, globs (*?[]) and POSIX regexes (~REGEX)
+#define MATCH_TRUNCATED 3       // the name, or its beginning (names truncated by agents)
+
+typedef struct matcher t_matcher;
+typedef void (*matcher_found)(void *data, void *ctx);
+
+int matcher_mode(const char *arg);
+t_matcher *matcher_new(int mode);
+int matcher_add(t_matcher * m, const char *pattern, void *data);
+int matcher_find(t_matcher * m, const char *name, size_t length, matcher_found found, void *ctx);
+void matcher_free(t_matcher * m);
+
+/* Options of the plugins (getopt), also read by check_snmp in the arguments
+ * of its checks */
+#define DISK_OPTIONS "?hVdvlt:w:c:m:C:H:s:f:F:M:R:u:p:k:x:X:W:P:o:I:S:"
+#define PROCESS_OPTIONS "?hVdvRAGt:w:c:r:m:M:C:H:s:u:p:k:x:X:W:P:o:I:U:N:S:"
+#define LOAD_OPTIONS "?hVdvt:w:c:m:C:H:s:u:p:k:x:X:P:o:T:S:"
+
+/* Session and subtrees shared by the checks of check_snmp (snmp-shared.c) */
+#define PREFETCH_ROOTS_MAX 16
+
+void snmp_share_session(netsnmp_session * ss);
+int snmp_session_shared(netsnmp_session * ss);
+void snmp_shared_fork(void);
+void snmp_shared_exit(void);
+void snmp_shared_wait(void);
+netsnmp_session *snmp_open_session(netsnmp_session * session);
+void snmp_close_session(netsnmp_session * ss);
+int snmp_prefetch(netsnmp_session * ss, oid ** roots, size_t * rootlens, int nroots);
+netsnmp_pdu *prefetch_next(oid ** names, size_t * names_length, int ncolumns);
+int prefetch_get(const oid * name, size_t name_length, netsnmp_variable_list ** vars);
+int prefetch_active(void);
+void prefetch_free(void);
+
+/* Timeout of each host from its round trip times (snmp-rtt.c) */
+#define RTT_TIMEOUT_MIN 200000L // us
+#define RTT_RETRY_BUDGET 3      // retries up to 3 timeouts of the session (-t)
+#define RTT_MAX_MS 60000.0
+
+void rtt_apply(netsnmp_session * ss, int verbose);
+long long rtt_start(void);
+void rtt_sample(netsnmp_session * ss, long long start);
+void rtt_timeout(void);
+void rtt_save(void);
+void rtt_share(void);
+
+/* Cost of a check : requests, bytes, time of each phase (snmp-stats.c, -S) */
+#define STATS_OFF 0
+#define STATS_STDERR 1          // totals on stderr
+#define STATS_PERF 2            // totals as perfdata
+
+int stats_mode(const char *arg);
+void stats_set_mode(int mode);
+void stats_start(void);
+void stats_phase(const char *name);
+void stats_request(netsnmp_pdu * pdu);
+void stats_timeout(void);
+void stats_session(netsnmp_session * ss);
+void stats_print(void);
+
+#define NOCONFIG_ENV "CHECK_SNMP_NOCONFIG"
+
+void snmp_startup(const char *type, int verbose);
 void print_version(void);
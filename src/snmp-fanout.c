@@ -0,0 +1,318 @@
+/*
+ *    snmp-fanout . Check many hosts in one run of a Nagios snmp plugin
+ *
+ *    Copyright (C) 2006  Vincent GERARD v.ge@wanadoo.fr
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; see the file COPYING. If not, write to the
+ *    Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <net-snmp/net-snmp-config.h>
+#include <net-snmp/net-snmp-includes.h>
+#include <sys/wait.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include "snmp-common.h"
+
+/*
+ * hostlist_add : add a host (trimmed, comments and empty lines ignored)
+ */
+
+static void hostlist_add(char *host, char ***hostsp, int *nhosts, int *allocated)
+{
+    char *end;
+
+    while (isspace((unsigned char)*host))
+        host++;
+    if ((end = strchr(host, '#')) != NULL)
+        *end = '\0';
+    for (end = host + strlen(host); end > host && isspace((unsigned char)end[-1]); end--)
+        *(end - 1) = '\0';
+
+    if (*host == '\0')
+        return;
+
+    if (*nhosts == *allocated) {
+        *allocated = *allocated ? *allocated * 2 : 16;
+        *hostsp = realloc(*hostsp, *allocated * sizeof(char *));
+    }
+    (*hostsp)[(*nhosts)++] = strdup(host);
+}
+
+/*
+ * snmp_hostlist : parse the argument of -H
+ *	  - HOST		: one host, no fan-out
+ *	  - HOST1,HOST2,...	: list of hosts
+ *	  - @FILE		: one host per line in FILE
+ *	  - -			: one host per line on stdin
+ *
+ *	args : arg = argument of -H, *hostsp = where the list is returned
+ *
+ * return : number of hosts of the list, 0 if arg is a single host,
+ *	    -1 if the file can't be read
+ */
+
+int snmp_hostlist(char *arg, char ***hostsp)
+{
+    char line[1024], *token, *copy;
+    FILE *fp;
+    int nhosts = 0, allocated = 0;
+
+    *hostsp = NULL;
+
+    if (*arg == '@' || !strcmp(arg, "-")) {
+        if (*arg == '-')
+            fp = stdin;
+        else if ((fp = fopen(arg + 1, "r")) == NULL)
+            return -1;
+
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            line[strcspn(line, "\r\n")] = '\0';
+            hostlist_add(line, hostsp, &nhosts, &allocated);
+        }
+
+        if (fp != stdin)
+            fclose(fp);
+
+        return nhosts;
+    }
+
+    if (strchr(arg, ',') == NULL)
+        return 0;
+
+    copy = strdup(arg);
+    for (token = strtok(copy, ","); token; token = strtok(NULL, ","))
+        hostlist_add(token, hostsp, &nhosts, &allocated);
+    free(copy);
+
+    return nhosts;
+}
+
+/*
+ * fanout_output : one line of the result of a host (newlines escaped, like
+ *		   in Nagios passive checks)
+ */
+
+static void fanout_output(FILE *fp, const char *host, int code, const char *output)
+{
+    fprintf(fp, "%s;%d;", host, code);
+    for (; *output; output++) {
+        if (*output == '\n') {
+            if (output[1] != '\0')
+                fputs("\\n", fp);
+        } else {
+            fputc(*output, fp);
+        }
+    }
+    fputc('\n', fp);
+}
+
+/* Worst status first : CRITICAL, UNKNOWN, WARNING, OK */
+static int fanout_rank(int code)
+{
+    switch (code) {
+    case OK:
+        return 0;
+    case WARNING:
+        return 1;
+    case CRITICAL:
+        return 3;
+    default:
+        return 2;
+    }
+}
+
+/*
+ * snmp_worst : worst of two Nagios codes
+ */
+
+int snmp_worst(int code1, int code2)
+{
+    return fanout_rank(code1) >= fanout_rank(code2) ? code1 : code2;
+}
+
+/*
+ * snmp_fanout : check a list of hosts, up to parallel at the same time
+ *
+ *	Each host is checked in a child process forked from the plugin after
+ *	its initialization (MIB, config, SNMPv3 keys are done only once) :
+ *	there is no exec nor init per host, but still a fork.
+ *	Its stdout and stderr are read by the parent process.
+ *	The result of each host is printed as soon as it is known :
+ *		HOST;EXIT_CODE;PLUGIN OUTPUT
+ *
+ *	args : hosts / nhosts = list of hosts
+ *	       parallel = max number of hosts checked at the same time
+ *	       statusfile = if not NULL, file written at the end with the
+ *			    result of each host (same format)
+ *	       check(host, ctx) = check a host, print its result, return
+ *				  its Nagios code
+ *
+ * return : worst Nagios code of all the hosts
+ */
+
+int snmp_fanout(char **hosts, int nhosts, int parallel, const char *statusfile,
+                int (*check)(char *host, void *ctx), void *ctx)
+{
+    struct fanout_child {
+        pid_t pid;
+        int host;
+        char *buf;
+        size_t len, size;
+    } *children;
+    struct pollfd *fds;
+    char **outputs = NULL, tmppath[PATH_MAX];
+    int *codes = NULL;
+    int next = 0, running = 0, worst = OK, count, code, status, pipefd[2];
+    ssize_t n;
+    FILE *fp;
+
+    if (parallel < 1)
+        parallel = 1;
+    if (parallel > nhosts)
+        parallel = nhosts;
+
+    children = calloc(parallel, sizeof(struct fanout_child));
+    fds = calloc(parallel, sizeof(struct pollfd));
+    if (statusfile) {
+        outputs = calloc(nhosts, sizeof(char *));
+        codes = calloc(nhosts, sizeof(int));
+    }
+
+    for (count = 0; count < parallel; count++)
+        fds[count].fd = -1;
+
+    while (next < nhosts || running > 0) {
+        /* Start the next hosts */
+        for (count = 0; count < parallel && next < nhosts; count++) {
+            if (fds[count].fd >= 0)
+                continue;
+
+            if (pipe(pipefd) != 0) {
+                fanout_output(stdout, hosts[next++], UNKNOWN, "UNKNOWN: can't create pipe");
+                worst = fanout_rank(worst) > fanout_rank(UNKNOWN) ? worst : UNKNOWN;
+                continue;
+            }
+
+            /* Not printed again by the child */
+            fflush(stdout);
+            children[count].pid = fork();
+            if (children[count].pid == 0) {
+                /* Child : result in the pipe */
+                close(pipefd[0]);
+                dup2(pipefd[1], STDOUT_FILENO);
+                dup2(pipefd[1], STDERR_FILENO);
+                close(pipefd[1]);
+                code = check(hosts[next], ctx);
+                fflush(stdout);
+                _exit(code);
+            }
+
+            close(pipefd[1]);
+            if (children[count].pid < 0) {
+                close(pipefd[0]);
+                fanout_output(stdout, hosts[next++], UNKNOWN, "UNKNOWN: can't fork");
+                worst = fanout_rank(worst) > fanout_rank(UNKNOWN) ? worst : UNKNOWN;
+                continue;
+            }
+
+            children[count].host = next++;
+            children[count].len = 0;
+            fds[count].fd = pipefd[0];
+            fds[count].events = POLLIN;
+            running++;
+        }
+
+        if (running == 0)
+            continue;
+
+        if (poll(fds, parallel, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        for (count = 0; count < parallel; count++) {
+            struct fanout_child *child = &children[count];
+
+            if (fds[count].fd < 0 || !(fds[count].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+
+            if (child->len + 512 > child->size) {
+                child->size = child->size ? child->size * 2 : 1024;
+                child->buf = realloc(child->buf, child->size);
+            }
+
+            n = read(fds[count].fd, child->buf + child->len, child->size - child->len - 1);
+            if (n > 0) {
+                child->len += n;
+                continue;
+            }
+            if (n < 0 && errno == EINTR)
+                continue;
+
+            /* End of the output : host done */
+            close(fds[count].fd);
+            fds[count].fd = -1;
+            running--;
+
+            child->buf[child->len] = '\0';
+            code = UNKNOWN;
+            if (waitpid(child->pid, &status, 0) == child->pid && WIFEXITED(status))
+                code = WEXITSTATUS(status);
+
+            if (fanout_rank(code) > fanout_rank(worst))
+                worst = code;
+
+            fanout_output(stdout, hosts[child->host], code, child->buf);
+            fflush(stdout);
+
+            if (statusfile) {
+                codes[child->host] = code;
+                outputs[child->host] = strdup(child->buf);
+            }
+        }
+    }
+
+    /* Status of all the hosts, replaced at once */
+    if (statusfile) {
+        snprintf(tmppath, sizeof(tmppath), "%s.%ld", statusfile, (long)getpid());
+        if ((fp = fopen(tmppath, "w")) != NULL) {
+            for (count = 0; count < nhosts; count++) {
+                fanout_output(fp, hosts[count], outputs[count] ? codes[count] : UNKNOWN,
+                              outputs[count] ? outputs[count] : "UNKNOWN: not checked");
+                free(outputs[count]);
+            }
+            if (fclose(fp) != 0 || rename(tmppath, statusfile) != 0) {
+                unlink(tmppath);
+                printf("Can't write status file %s\n", statusfile);
+                worst = fanout_rank(worst) > fanout_rank(UNKNOWN) ? worst : UNKNOWN;
+            }
+        } else {
+            printf("Can't write status file %s\n", statusfile);
+            worst = fanout_rank(worst) > fanout_rank(UNKNOWN) ? worst : UNKNOWN;
+        }
+        free(outputs);
+        free(codes);
+    }
+
+    for (count = 0; count < parallel; count++)
+        free(children[count].buf);
+    free(children);
+    free(fds);
+
+    return worst;
+}
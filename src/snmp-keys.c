@@ -0,0 +1,509 @@
+/*
+ *    snmp-keys . SNMPv3 key cache for Nagios snmp plugins
+ *
+ *    Copyright (C) 2006  Vincent GERARD v.ge@wanadoo.fr
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; see the file COPYING. If not, write to the
+ *    Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Turning a passphrase into a key (generate_Ku) hashes 1MB of data, for the
+ * authentication and for the privacy passphrases, on each run. The keys are
+ * kept in the state directory (files only readable by their owner) :
+ *   - keys.secret : random key of the directory, made on the first run
+ *   - ku-HASH.key : Ku of a passphrase, HASH = HMAC-SHA-1 of algo + passphrase
+ *		     keyed by keys.secret : the names tell nothing about the
+ *		     passphrases without the secret (no dictionary attack)
+ *   - PEER.kul    : engineID, engineBoots and engineTime of the peer and the
+ *		     keys localized for it (Kul), with a tag of the credentials
+ *		     they were made from
+ * With the Kul of a peer, snmp_open() has neither a key to localize nor an
+ * engineID to discover, and the first request is in the time window of the
+ * agent : no discovery exchange at all.
+ * If the agent doesn't know the engineID anymore (or the time is wrong), the
+ * first request gets a report : the discovery is done then, and the request
+ * sent again (snmp_synch_request, or snmp_get_batch with snmpv3_rediscover).
+ */
+
+#include <net-snmp/net-snmp-config.h>
+#include <net-snmp/net-snmp-includes.h>
+#include <time.h>
+#include "snmp-common.h"
+
+#define KEY_HASH_LEN 20         // SHA-1
+#define KEY_BLOCK_LEN 64        // SHA-1 block, for HMAC
+#define KEY_ENGINEID_MAX 32     // RFC 3411
+#define KEY_LINE_MAX 256
+
+/* Engine and Kul of the current peer, pointed by the session when loaded */
+static struct {
+    int loaded;
+    int confirmed;              // a request succeeded with them
+    u_char engineid[KEY_ENGINEID_MAX];
+    size_t engineid_len;
+    u_char auth[USM_AUTH_KU_LEN];
+    size_t auth_len;
+    u_char priv[USM_PRIV_KU_LEN];
+    size_t priv_len;
+    u_int boots;
+    u_int time;
+} kul;
+
+static void hex_encode(const u_char *buf, size_t len, char *hex)
+{
+    size_t count;
+
+    for (count = 0; count < len; count++)
+        sprintf(hex + 2 * count, "%02x", buf[count]);
+    hex[2 * len] = '\0';
+}
+
+/* return : number of bytes decoded, -1 if hex is invalid or too long */
+static int hex_decode(const char *hex, u_char *buf, size_t size)
+{
+    size_t len = strspn(hex, "0123456789abcdefABCDEF"), count;
+    unsigned int byte;
+
+    if (len % 2 || len / 2 > size || (hex[len] != '\0' && hex[len] != '\n'))
+        return -1;
+
+    for (count = 0; count < len / 2; count++) {
+        sscanf(hex + 2 * count, "%2x", &byte);
+        buf[count] = byte;
+    }
+
+    return len / 2;
+}
+
+/* key_hash : SHA-1 of buf, in hex (2 * KEY_HASH_LEN + 1 bytes) */
+static int key_hash(const u_char *buf, size_t len, char *hex)
+{
+    u_char hash[KEY_HASH_LEN];
+    size_t hash_len = sizeof(hash);
+
+    if (sc_hash(usmHMACSHA1AuthProtocol, OID_LENGTH(usmHMACSHA1AuthProtocol), buf, len, hash, &hash_len) !=
+        SNMPERR_SUCCESS)
+        return -1;
+
+    hex_encode(hash, hash_len, hex);
+    return 0;
+}
+
+/* secret_read : the secret of the state directory, -1 if there is none */
+static int secret_read(u_char *secret)
+{
+    char line[KEY_LINE_MAX];
+    FILE *fp;
+    int len;
+
+    if ((fp = state_open_read("keys", "secret")) == NULL)
+        return -1;
+
+    len = fgets(line, sizeof(line), fp) ? hex_decode(line, secret, KEY_HASH_LEN) : -1;
+    memset(line, 0, sizeof(line));
+    fclose(fp);
+
+    return len == KEY_HASH_LEN ? 0 : -1;
+}
+
+/*
+ * key_secret : the secret of the state directory, made if there is none yet
+ *
+ * It is only read from or written to the state directory once trusted
+ * (state_open_read / write) : without it, the keys are not kept.
+ *
+ * return : 0 if ok, -1 if there is no usable secret
+ */
+
+static int key_secret(u_char *secret)
+{
+    char line[KEY_LINE_MAX];
+    FILE *fp;
+    size_t len;
+
+    if (secret_read(secret) == 0)
+        return 0;
+
+    if ((fp = fopen("/dev/urandom", "r")) == NULL)
+        return -1;
+    len = fread(secret, 1, KEY_HASH_LEN, fp);
+    fclose(fp);
+
+    if (len == KEY_HASH_LEN && (fp = state_open_write("keys", "secret")) != NULL) {
+        hex_encode(secret, KEY_HASH_LEN, line);
+        fprintf(fp, "%s\n", line);
+        memset(line, 0, sizeof(line));
+        state_close_write(fp, "keys", "secret");
+    }
+    memset(secret, 0, KEY_HASH_LEN);
+
+    /* Read again : if checks made one at the same time, the last renamed */
+    return secret_read(secret);
+}
+
+/* key_hmac : HMAC-SHA-1 (RFC 2104) of buf with the secret, in hex */
+static int key_hmac(const u_char *secret, const u_char *buf, size_t len, char *hex)
+{
+    u_char *msg, inner[KEY_BLOCK_LEN + KEY_HASH_LEN];
+    size_t hash_len = KEY_HASH_LEN;
+    int count, ret = -1;
+
+    if ((msg = malloc(KEY_BLOCK_LEN + len)) == NULL)
+        return -1;
+
+    memset(msg, 0x36, KEY_BLOCK_LEN);
+    memset(inner, 0x5c, KEY_BLOCK_LEN);
+    for (count = 0; count < KEY_HASH_LEN; count++) {
+        msg[count] ^= secret[count];
+        inner[count] ^= secret[count];
+    }
+    memcpy(msg + KEY_BLOCK_LEN, buf, len);
+
+    if (sc_hash(usmHMACSHA1AuthProtocol, OID_LENGTH(usmHMACSHA1AuthProtocol), msg, KEY_BLOCK_LEN + len,
+                inner + KEY_BLOCK_LEN, &hash_len) == SNMPERR_SUCCESS && hash_len == KEY_HASH_LEN)
+        ret = key_hash(inner, sizeof(inner), hex);
+
+    memset(msg, 0, KEY_BLOCK_LEN + len);
+    memset(inner, 0, sizeof(inner));
+    free(msg);
+
+    return ret;
+}
+
+/*
+ * snmpv3_generate_Ku : generate_Ku(), with the keys kept on disk
+ *
+ *	args : like generate_Ku()
+ *
+ * return : SNMPERR_SUCCESS or the error of generate_Ku()
+ */
+
+int snmpv3_generate_Ku(const oid *hashtype, u_int hashtype_len, const char *passphrase, u_char *Ku, size_t *kulen)
+{
+    char name[3 + 2 * KEY_HASH_LEN + 1], line[KEY_LINE_MAX];
+    size_t pass_len = strlen(passphrase), buf_len = hashtype_len * sizeof(oid) + pass_len;
+    u_char *buf, secret[KEY_HASH_LEN];
+    FILE *fp;
+    int ret, len;
+
+    /* Name of the key : keyed hash of the algo and the passphrase */
+    if (key_secret(secret) != 0 || (buf = malloc(buf_len)) == NULL) {
+        memset(secret, 0, sizeof(secret));
+        return generate_Ku(hashtype, hashtype_len, (const u_char *)passphrase, pass_len, Ku, kulen);
+    }
+    memcpy(buf, hashtype, hashtype_len * sizeof(oid));
+    memcpy(buf + hashtype_len * sizeof(oid), passphrase, pass_len);
+    strcpy(name, "ku-");
+    ret = key_hmac(secret, buf, buf_len, name + 3);
+    memset(buf, 0, buf_len);
+    memset(secret, 0, sizeof(secret));
+    free(buf);
+
+    if (ret != 0)
+        return generate_Ku(hashtype, hashtype_len, (const u_char *)passphrase, pass_len, Ku, kulen);
+
+    if ((fp = state_open_read(name, "key")) != NULL) {
+        len = fgets(line, sizeof(line), fp) ? hex_decode(line, Ku, *kulen) : -1;
+        memset(line, 0, sizeof(line));
+        fclose(fp);
+
+        if (len > 0 && len == sc_get_properlength(hashtype, hashtype_len)) {
+            *kulen = len;
+            return SNMPERR_SUCCESS;
+        }
+    }
+
+    ret = generate_Ku(hashtype, hashtype_len, (const u_char *)passphrase, pass_len, Ku, kulen);
+
+    if (ret == SNMPERR_SUCCESS && (fp = state_open_write(name, "key")) != NULL) {
+        hex_encode(Ku, *kulen, line);
+        fprintf(fp, "%s\n", line);
+        memset(line, 0, sizeof(line));
+        state_close_write(fp, name, "key");
+    }
+
+    return ret;
+}
+
+/*
+ * keys_tag : tag of the credentials of a session (user, algos and Ku)
+ */
+
+static int keys_tag(const netsnmp_session *session, char *hex)
+{
+    u_char buf[SNMP_MAX_SEC_NAME_SIZE + 2 * MAX_OID_LEN * sizeof(oid) + USM_AUTH_KU_LEN + USM_PRIV_KU_LEN];
+    size_t len = 0;
+    int ret;
+
+    if (session->securityNameLen > SNMP_MAX_SEC_NAME_SIZE || session->securityAuthProtoLen > MAX_OID_LEN ||
+        session->securityPrivProtoLen > MAX_OID_LEN)
+        return -1;
+
+    memcpy(buf + len, session->securityName, session->securityNameLen);
+    len += session->securityNameLen;
+    memcpy(buf + len, session->securityAuthProto, session->securityAuthProtoLen * sizeof(oid));
+    len += session->securityAuthProtoLen * sizeof(oid);
+    memcpy(buf + len, session->securityAuthKey, session->securityAuthKeyLen);
+    len += session->securityAuthKeyLen;
+
+    if (session->securityLevel == SNMP_SEC_LEVEL_AUTHPRIV) {
+        memcpy(buf + len, session->securityPrivProto, session->securityPrivProtoLen * sizeof(oid));
+        len += session->securityPrivProtoLen * sizeof(oid);
+        memcpy(buf + len, session->securityPrivKey, session->securityPrivKeyLen);
+        len += session->securityPrivKeyLen;
+    }
+
+    ret = key_hash(buf, len, hex);
+    memset(buf, 0, sizeof(buf));
+
+    return ret;
+}
+
+/*
+ * snmpv3_load_keys : use the engineID and the Kul known for the peer of
+ *		      the session (before snmp_open)
+ *
+ * return : 1 if they are used, 0 if not
+ */
+
+int snmpv3_load_keys(netsnmp_session *session)
+{
+    char line[KEY_LINE_MAX], tag[2 * KEY_HASH_LEN + 1], name[16];
+    int len, valid = 0;
+    long saved = 0;
+    FILE *fp;
+
+    memset(&kul, 0, sizeof(kul));
+
+    if (session->version != SNMP_VERSION_3 || keys_tag(session, tag) != 0)
+        return 0;
+
+    if ((fp = state_open_read(session->peername, "kul")) == NULL)
+        return 0;
+
+    while (fscanf(fp, "%15s %255s", name, line) == 2) {
+        if (!strcmp(name, "tag")) {
+            valid = !strcmp(line, tag);
+        } else if (!strcmp(name, "engineid")) {
+            kul.engineid_len = (len = hex_decode(line, kul.engineid, sizeof(kul.engineid))) > 0 ? len : 0;
+        } else if (!strcmp(name, "auth")) {
+            kul.auth_len = (len = hex_decode(line, kul.auth, sizeof(kul.auth))) > 0 ? len : 0;
+        } else if (!strcmp(name, "priv")) {
+            kul.priv_len = (len = hex_decode(line, kul.priv, sizeof(kul.priv))) > 0 ? len : 0;
+        } else if (!strcmp(name, "boots")) {
+            kul.boots = strtoul(line, NULL, 10);
+        } else if (!strcmp(name, "time")) {
+            kul.time = strtoul(line, NULL, 10);
+        } else if (!strcmp(name, "saved")) {
+            saved = strtol(line, NULL, 10);
+        }
+    }
+    memset(line, 0, sizeof(line));
+    fclose(fp);
+
+    if (!valid || !kul.engineid_len || !kul.auth_len ||
+        (session->securityLevel == SNMP_SEC_LEVEL_AUTHPRIV && !kul.priv_len)) {
+        memset(&kul, 0, sizeof(kul));
+        return 0;
+    }
+
+    kul.loaded = 1;
+    session->securityEngineID = kul.engineid;
+    session->securityEngineIDLen = kul.engineid_len;
+    session->securityAuthLocalKey = kul.auth;
+    session->securityAuthLocalKeyLen = kul.auth_len;
+    if (session->securityLevel == SNMP_SEC_LEVEL_AUTHPRIV) {
+        session->securityPrivLocalKey = kul.priv;
+        session->securityPrivLocalKeyLen = kul.priv_len;
+    }
+
+    /* engineTime has gone on since it was saved */
+    if (saved > 0 && time(NULL) >= saved) {
+        kul.time += time(NULL) - saved;
+        set_enginetime(kul.engineid, kul.engineid_len, kul.boots, kul.time, TRUE);
+    }
+
+    return 1;
+}
+
+/*
+ * engine_rediscover : discover the engine of the peer of an opened session,
+ *		       whose engineID (or time) from the state file is wrong
+ *
+ * return : 1 if the session can be used again, 0 if not
+ */
+
+static int engine_rediscover(netsnmp_session *ss)
+{
+    state_remove(ss->peername, "kul");
+    memset(&kul, 0, sizeof(kul));
+
+    SNMP_FREE(ss->securityEngineID);
+    ss->securityEngineIDLen = 0;
+    SNMP_FREE(ss->contextEngineID);
+    ss->contextEngineIDLen = 0;
+    SNMP_FREE(ss->securityAuthLocalKey);
+    ss->securityAuthLocalKeyLen = 0;
+    SNMP_FREE(ss->securityPrivLocalKey);
+    ss->securityPrivLocalKeyLen = 0;
+
+    /* Probe, and localize the keys (Ku still in the session) */
+    return snmpv3_engineID_probe(snmp_sess_pointer(ss), ss) ? 1 : 0;
+}
+
+/*
+ * snmpv3_rediscover : a request sent asynchronously (snmp_get_batch) got a
+ *		       report : the discovery is done again, once, if the
+ *		       engine loaded from the state file never worked
+ *
+ * return : 1 if the requests can be sent again, 0 if not
+ */
+
+int snmpv3_rediscover(netsnmp_session *ss)
+{
+    if (!kul.loaded || kul.confirmed)
+        return 0;
+
+    return engine_rediscover(ss);
+}
+
+/*
+ * snmp_synch_request : snmp_synch_response(), for the requests of the checks
+ *
+ * Until a request succeeds with the engine loaded from the state file, a
+ * failed request (report from the agent : unknown engineID, not in time
+ * window, wrong digest) is sent again after a new discovery.
+ *
+ * return : like snmp_synch_response()
+ */
+
+int snmp_synch_request(netsnmp_session *ss, netsnmp_pdu *pdu, netsnmp_pdu **response)
+{
+    netsnmp_pdu *copy = NULL;
+    long long start;
+    int status;
+
+    if (kul.loaded && !kul.confirmed)
+        copy = snmp_clone_pdu(pdu);
+
+    stats_request(pdu);
+    start = rtt_start();
+    status = snmp_synch_response(ss, pdu, response);
+    if (status == STAT_SUCCESS) {
+        rtt_sample(ss, start);
+    } else if (status == STAT_TIMEOUT) {
+        stats_timeout();
+        rtt_timeout();
+    }
+
+    if (copy == NULL)
+        return status;
+
+    if (status == STAT_SUCCESS) {
+        kul.confirmed = 1;
+        snmp_free_pdu(copy);
+        return status;
+    }
+
+    /* A timeout is not a proof that the engine changed : no discovery */
+    if (status != STAT_ERROR || !engine_rediscover(ss)) {
+        snmp_free_pdu(copy);
+        return status;
+    }
+
+    if (*response) {
+        snmp_free_pdu(*response);
+        *response = NULL;
+    }
+
+    stats_request(copy);
+    start = rtt_start();
+    if ((status = snmp_synch_response(ss, copy, response)) == STAT_SUCCESS) {
+        rtt_sample(ss, start);
+    } else if (status == STAT_TIMEOUT) {
+        stats_timeout();
+        rtt_timeout();
+    }
+
+    return status;
+}
+
+/*
+ * snmpv3_save_keys : keep the engine and the Kul of the peer (after the
+ *		      check)
+ *
+ *	args : session = session given to snmp_open, ss = opened session
+ *	       failed = the check failed : if the engine was loaded and never
+ *			worked, it may be the reason, it is forgotten
+ */
+
+void snmpv3_save_keys(netsnmp_session *session, netsnmp_session *ss, int failed)
+{
+    char line[2 * USM_AUTH_KU_LEN + 1], tag[2 * KEY_HASH_LEN + 1];
+    u_int boots = 0, enginetime = 0;
+    FILE *fp;
+
+    if (session->version != SNMP_VERSION_3)
+        return;
+
+    if (kul.loaded && failed && !kul.confirmed) {
+        state_remove(session->peername, "kul");
+        return;
+    }
+
+    if (ss->securityEngineIDLen == 0 || ss->securityEngineIDLen > KEY_ENGINEID_MAX || keys_tag(session, tag) != 0)
+        return;
+
+    get_enginetime(ss->securityEngineID, ss->securityEngineIDLen, &boots, &enginetime, TRUE);
+
+    /* Nothing new : the time is computed from the last save */
+    if (kul.loaded && boots == kul.boots)
+        return;
+
+    if (!kul.loaded) {
+        memcpy(kul.engineid, ss->securityEngineID, ss->securityEngineIDLen);
+        kul.engineid_len = ss->securityEngineIDLen;
+
+        kul.auth_len = sizeof(kul.auth);
+        if (generate_kul(session->securityAuthProto, session->securityAuthProtoLen, kul.engineid, kul.engineid_len,
+                         session->securityAuthKey, session->securityAuthKeyLen, kul.auth,
+                         &kul.auth_len) != SNMPERR_SUCCESS)
+            return;
+
+        kul.priv_len = sizeof(kul.priv);
+        if (session->securityLevel == SNMP_SEC_LEVEL_AUTHPRIV &&
+            generate_kul(session->securityAuthProto, session->securityAuthProtoLen, kul.engineid, kul.engineid_len,
+                         session->securityPrivKey, session->securityPrivKeyLen, kul.priv,
+                         &kul.priv_len) != SNMPERR_SUCCESS)
+            return;
+    }
+
+    if ((fp = state_open_write(session->peername, "kul")) == NULL)
+        return;
+
+    fprintf(fp, "tag %s\n", tag);
+    hex_encode(kul.engineid, kul.engineid_len, line);
+    fprintf(fp, "engineid %s\n", line);
+    hex_encode(kul.auth, kul.auth_len, line);
+    fprintf(fp, "auth %s\n", line);
+    if (session->securityLevel == SNMP_SEC_LEVEL_AUTHPRIV) {
+        hex_encode(kul.priv, kul.priv_len, line);
+        fprintf(fp, "priv %s\n", line);
+    }
+    memset(line, 0, sizeof(line));
+    fprintf(fp, "boots %u\ntime %u\nsaved %ld\n", boots, enginetime, (long)time(NULL));
+
+    state_close_write(fp, session->peername, "kul");
+}
@@ -0,0 +1,266 @@
+/*
+ *    snmp-match . Name matching for Nagios snmp plugins
+ *
+ *    Copyright (C) 2006  Vincent GERARD v.ge@wanadoo.fr
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; see the file COPYING. If not, write to the
+ *    Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * A matcher holds all the names searched by a check, compiled once :
+ *   - names without wildcards are in a hash table (case ignored) : the cost
+ *     of a match doesn't depend on the number of names,
+ *   - globs (*, ?, [...]) and regexes (~REGEX, POSIX extended) are tried
+ *     one after the other, they are meant to be few.
+ * In MATCH_PREFIX mode, every beginning of a value is searched in the hash
+ * table. In MATCH_TRUNCATED mode, every beginning of a name is in it.
+ */
+
+#define _GNU_SOURCE             // FNM_CASEFOLD
+#include <net-snmp/net-snmp-config.h>
+#include <net-snmp/net-snmp-includes.h>
+#include <ctype.h>
+#include <fnmatch.h>
+#include <regex.h>
+#include "snmp-common.h"
+
+#define MATCH_NAME_MAX 256
+
+typedef struct matcher_entry {
+    char *key;                  // lower case
+    size_t length;
+    unsigned int hash;
+    int next;                   // next entry of the bucket, -1 = end
+    void *data;
+} t_matcher_entry;
+
+typedef struct matcher_pattern {
+    char *pattern;
+    int isregex;
+    regex_t regex;
+    void *data;
+} t_matcher_pattern;
+
+struct matcher {
+    int mode;
+    t_matcher_entry *entries;
+    int nentries, allocated;
+    int *buckets;
+    int nbuckets;
+    t_matcher_pattern *patterns;
+    int npatterns;
+};
+
+/* FNV-1a, case ignored */
+static unsigned int matcher_hash(const char *key, size_t length)
+{
+    unsigned int hash = 2166136261U;
+    size_t count;
+
+    for (count = 0; count < length; count++) {
+        hash ^= (unsigned char)tolower((unsigned char)key[count]);
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+static void matcher_rehash(t_matcher *m)
+{
+    int count, bucket;
+
+    free(m->buckets);
+    m->nbuckets = m->nbuckets ? m->nbuckets * 2 : 64;
+    m->buckets = malloc(m->nbuckets * sizeof(int));
+
+    for (count = 0; count < m->nbuckets; count++)
+        m->buckets[count] = -1;
+
+    for (count = 0; count < m->nentries; count++) {
+        bucket = m->entries[count].hash & (m->nbuckets - 1);
+        m->entries[count].next = m->buckets[bucket];
+        m->buckets[bucket] = count;
+    }
+}
+
+static void matcher_add_key(t_matcher *m, const char *key, size_t length, void *data)
+{
+    t_matcher_entry *entry;
+    size_t count;
+    int bucket;
+
+    if (m->nentries == m->allocated) {
+        m->allocated = m->allocated ? m->allocated * 2 : 16;
+        m->entries = realloc(m->entries, m->allocated * sizeof(t_matcher_entry));
+    }
+
+    entry = &m->entries[m->nentries++];
+    entry->key = malloc(length + 1);
+    for (count = 0; count < length; count++)
+        entry->key[count] = tolower((unsigned char)key[count]);
+    entry->key[length] = '\0';
+    entry->length = length;
+    entry->hash = matcher_hash(key, length);
+    entry->data = data;
+
+    if (m->nentries * 2 > m->nbuckets) {
+        matcher_rehash(m);
+    } else {
+        bucket = entry->hash & (m->nbuckets - 1);
+        entry->next = m->buckets[bucket];
+        m->buckets[bucket] = m->nentries - 1;
+    }
+}
+
+/*
+ * matcher_mode : parse a match mode (-M)
+ *
+ * return : MATCH_EXACT, MATCH_PREFIX, MATCH_PATTERN, MATCH_TRUNCATED, or -1
+ *	    if unknown
+ */
+
+int matcher_mode(const char *arg)
+{
+    if (!strcasecmp(arg, "exact"))
+        return MATCH_EXACT;
+    if (!strcasecmp(arg, "prefix"))
+        return MATCH_PREFIX;
+    if (!strcasecmp(arg, "pattern"))
+        return MATCH_PATTERN;
+    if (!strcasecmp(arg, "truncated"))
+        return MATCH_TRUNCATED;
+
+    return -1;
+}
+
+t_matcher *matcher_new(int mode)
+{
+    t_matcher *m = calloc(1, sizeof(t_matcher));
+
+    m->mode = mode;
+
+    return m;
+}
+
+/*
+ * matcher_add : add a name to search
+ *
+ *	args : m = matcher, pattern = name (glob or ~REGEX in MATCH_PATTERN
+ *	       mode), data = given back when a name matches
+ *
+ * return : 0 if ok, -1 if the regex is invalid
+ */
+
+int matcher_add(t_matcher *m, const char *pattern, void *data)
+{
+    t_matcher_pattern *p;
+    size_t length;
+
+    if (m->mode == MATCH_PATTERN && (*pattern == '~' || strpbrk(pattern, "*?[") != NULL)) {
+        m->patterns = realloc(m->patterns, (m->npatterns + 1) * sizeof(t_matcher_pattern));
+        p = &m->patterns[m->npatterns];
+        p->isregex = *pattern == '~';
+        p->data = data;
+
+        if (p->isregex && regcomp(&p->regex, pattern + 1, REG_EXTENDED | REG_ICASE | REG_NOSUB) != 0)
+            return -1;
+
+        p->pattern = strdup(pattern);
+        m->npatterns++;
+        return 0;
+    }
+
+    if (m->mode == MATCH_TRUNCATED) {
+        /* The agent may give only the beginning of the name */
+        for (length = 1; length <= strlen(pattern); length++)
+            matcher_add_key(m, pattern, length, data);
+    } else {
+        matcher_add_key(m, pattern, strlen(pattern), data);
+    }
+
+    return 0;
+}
+
+/*
+ * matcher_find : search the names matching a value
+ *
+ *	args : m = matcher, name / length = value (not null terminated)
+ *	       found(data, ctx) = called for each name matching (may be NULL)
+ *
+ * return : number of names matching
+ */
+
+int matcher_find(t_matcher *m, const char *name, size_t length, matcher_found found, void *ctx)
+{
+    char buf[MATCH_NAME_MAX];
+    t_matcher_entry *entry;
+    unsigned int hash;
+    size_t keylen;
+    int count, index, nfound = 0;
+
+    if (length == 0)
+        return 0;
+
+    /* MATCH_PREFIX : each beginning of the value, else the whole value */
+    for (keylen = m->mode == MATCH_PREFIX ? 1 : length; m->nbuckets > 0 && keylen <= length; keylen++) {
+        hash = matcher_hash(name, keylen);
+
+        for (index = m->buckets[hash & (m->nbuckets - 1)]; index >= 0; index = entry->next) {
+            entry = &m->entries[index];
+            if (entry->hash == hash && entry->length == keylen && !strncasecmp(entry->key, name, keylen)) {
+                if (found)
+                    found(entry->data, ctx);
+                nfound++;
+            }
+        }
+    }
+
+    if (m->npatterns == 0)
+        return nfound;
+
+    length = length < sizeof(buf) ? length : sizeof(buf) - 1;
+    memcpy(buf, name, length);
+    buf[length] = '\0';
+
+    for (count = 0; count < m->npatterns; count++) {
+        if (m->patterns[count].isregex ? regexec(&m->patterns[count].regex, buf, 0, NULL, 0) == 0 :
+            fnmatch(m->patterns[count].pattern, buf, FNM_CASEFOLD) == 0) {
+            if (found)
+                found(m->patterns[count].data, ctx);
+            nfound++;
+        }
+    }
+
+    return nfound;
+}
+
+void matcher_free(t_matcher *m)
+{
+    int count;
+
+    for (count = 0; count < m->nentries; count++)
+        free(m->entries[count].key);
+
+    for (count = 0; count < m->npatterns; count++) {
+        if (m->patterns[count].isregex)
+            regfree(&m->patterns[count].regex);
+        free(m->patterns[count].pattern);
+    }
+
+    free(m->entries);
+    free(m->buckets);
+    free(m->patterns);
+    free(m);
+}
@@ -0,0 +1,203 @@
+/*
+ *    snmp-rtt . Timeout of each host from its round trip times
+ *
+ *    Copyright (C) 2006  Vincent GERARD v.ge@wanadoo.fr
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; see the file COPYING. If not, write to the
+ *    Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Like TCP (RFC 6298), a smoothed round trip time and its variation are
+ * kept for each host, in the state file "rtt", from run to run :
+ *	SRTT = 7/8 SRTT + 1/8 R		RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|
+ * The timeout of a request is SRTT + 4 RTTVAR, at least RTT_TIMEOUT_MIN and
+ * at most the timeout of the session (-t, or the one of net-snmp) : a fast
+ * host which stops answering is known dead sooner. The retries fill
+ * RTT_RETRY_BUDGET times the timeout of the session, up to its own retries.
+ *
+ * Only the answers received before the timeout are measured : they can't
+ * answer a retry (Karn). A request without answer doubles RTTVAR, so the
+ * next run waits longer. The checks of check_snmp measure in shared memory,
+ * and only check_snmp saves the file.
+ */
+
+#include <net-snmp/net-snmp-config.h>
+#include <net-snmp/net-snmp-includes.h>
+#include <sys/mman.h>
+#include <time.h>
+#include "snmp-common.h"
+
+typedef struct rtt_state {
+    netsnmp_session *ss;        // session with the timeout set
+    char *peer;
+    double srtt, rttvar;        // ms, 0 : not measured yet
+    int changed;
+} t_rtt_state;
+
+static t_rtt_state rtt_local = { NULL, NULL, 0, 0, 0 };
+static t_rtt_state *rtt = &rtt_local;
+
+/*
+ * rtt_apply : timeout and retries of an opened session, from the round trip
+ *	       times of its peer
+ *
+ *	args : ss = opened session (its timeout is the upper bound), verbose
+ */
+
+void rtt_apply(netsnmp_session *ss, int verbose)
+{
+    long bound = ss->timeout, timeout;
+    int retries;
+    FILE *fp;
+
+    /* Session of check_snmp, given to a check : already set */
+    if (ss == rtt->ss) {
+        if (verbose)
+            printf("RTT of %s : srtt %.1f ms, rttvar %.1f ms -> timeout %ld ms, %d retries\n", rtt->peer, rtt->srtt,
+                   rtt->rttvar, ss->timeout / 1000, ss->retries);
+        return;
+    }
+
+    rtt->ss = ss;
+    free(rtt->peer);
+    rtt->peer = strdup(ss->peername);
+    rtt->srtt = rtt->rttvar = 0;
+    rtt->changed = 0;
+
+    if ((fp = state_open_read(rtt->peer, "rtt")) != NULL) {
+        if (fscanf(fp, "%lf %lf", &rtt->srtt, &rtt->rttvar) != 2 || rtt->srtt <= 0 || rtt->rttvar < 0)
+            rtt->srtt = rtt->rttvar = 0;
+        fclose(fp);
+    }
+
+    if (rtt->srtt == 0 || bound <= 0) {
+        if (verbose)
+            printf("RTT of %s : not measured yet, timeout %ld ms, %d retries\n", rtt->peer, bound / 1000,
+                   ss->retries);
+        return;
+    }
+
+    timeout = (long)((rtt->srtt + 4 * rtt->rttvar) * 1000);
+    if (timeout < RTT_TIMEOUT_MIN)
+        timeout = RTT_TIMEOUT_MIN;
+    if (timeout > bound)
+        timeout = bound;
+
+    retries = RTT_RETRY_BUDGET * bound / timeout - 1;
+    if (retries > ss->retries)
+        retries = ss->retries;
+    if (retries < 1)
+        retries = 1;
+
+    if (verbose)
+        printf("RTT of %s : srtt %.1f ms, rttvar %.1f ms -> timeout %ld ms (max %ld), %d retries\n", rtt->peer,
+               rtt->srtt, rtt->rttvar, timeout / 1000, bound / 1000, retries);
+
+    ss->timeout = timeout;
+    ss->retries = retries;
+}
+
+/*
+ * rtt_start : time a request is sent (us, monotonic clock)
+ */
+
+long long rtt_start(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/*
+ * rtt_sample : an answer to the request sent at start
+ */
+
+void rtt_sample(netsnmp_session *ss, long long start)
+{
+    double r = (rtt_start() - start) / 1000.0, delta;
+
+    /* Maybe the answer to a retry */
+    if (rtt->peer == NULL || r * 1000 >= ss->timeout)
+        return;
+
+    if (rtt->srtt == 0) {
+        rtt->srtt = r;
+        rtt->rttvar = r / 2;
+    } else {
+        delta = rtt->srtt > r ? rtt->srtt - r : r - rtt->srtt;
+        rtt->rttvar = 0.75 * rtt->rttvar + 0.25 * delta;
+        rtt->srtt = 0.875 * rtt->srtt + 0.125 * r;
+    }
+    rtt->changed = 1;
+}
+
+/*
+ * rtt_timeout : no answer to a request, after all the retries
+ */
+
+void rtt_timeout(void)
+{
+    if (rtt->peer == NULL || rtt->srtt == 0)
+        return;
+
+    rtt->rttvar = rtt->rttvar > 0 ? rtt->rttvar * 2 : rtt->srtt / 2;
+    if (rtt->srtt < RTT_MAX_MS && rtt->srtt + 4 * rtt->rttvar > RTT_MAX_MS)
+        rtt->rttvar = (RTT_MAX_MS - rtt->srtt) / 4;
+    rtt->changed = 1;
+}
+
+/*
+ * rtt_save : keep the round trip times of the peer for the next run
+ */
+
+void rtt_save(void)
+{
+    FILE *fp;
+
+    /* The session is closed next : its address may be used again */
+    rtt->ss = NULL;
+
+    if (rtt->peer == NULL || !rtt->changed)
+        return;
+
+    if ((fp = state_open_write(rtt->peer, "rtt")) != NULL) {
+        fprintf(fp, "%.3f %.3f\n", rtt->srtt, rtt->rttvar);
+        state_close_write(fp, rtt->peer, "rtt");
+    }
+    rtt->changed = 0;
+}
+
+/*
+ * rtt_share : the round trip times measured by the processes forked next
+ *	       (the checks of check_snmp) are kept in this one too, which
+ *	       saves them once (shared memory)
+ */
+
+void rtt_share(void)
+{
+    t_rtt_state *shared;
+
+    if (rtt != &rtt_local)
+        return;
+
+    shared = mmap(NULL, sizeof(t_rtt_state), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED)
+        return;
+
+    *shared = rtt_local;
+    rtt = shared;
+}
@@ -0,0 +1,375 @@
+/*
+ *    snmp-shared . Session and subtrees shared by several checks (check_snmp)
+ *
+ *    Copyright (C) 2006  Vincent GERARD v.ge@wanadoo.fr
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; see the file COPYING. If not, write to the
+ *    Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * check_snmp runs several checks of the same host : they use the session it
+ * opened (one SNMPv3 discovery), and the subtrees they walk are fetched
+ * beforehand, all together : each GETBULK has one varbind per subtree.
+ * getNextColumns() and snmp_get_batch() then answer from these objects,
+ * without sending anything, for the OIDs under a prefetched subtree.
+ */
+
+#include <net-snmp/net-snmp-config.h>
+#include <net-snmp/net-snmp-includes.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include "snmp-common.h"
+
+/* Rows given by a GETBULK answered from memory, max columns of a walk */
+#define PREFETCH_ROWS 64
+#define PREFETCH_COLUMNS_MAX 16
+
+/* IDs skipped after a check which didn't tell the ones it used */
+#define SHARED_IDS_MARGIN 65536
+
+typedef struct prefetch_root {
+    oid root[MAX_OID_LEN];
+    size_t rootlen;
+    netsnmp_variable_list **vars;       // increasing OIDs
+    int nvars, allocated;
+} t_prefetch_root;
+
+static struct {
+    t_prefetch_root roots[PREFETCH_ROOTS_MAX];
+    int nroots;
+} prefetch;
+
+static netsnmp_session *shared_session = NULL;
+
+/*
+ * Next request and message IDs of the last check (shared memory) : each check
+ * is forked from the same process, and would start with the same IDs as the
+ * previous one. An answer to a request the previous check gave up on, still
+ * on the socket or late, would then be taken for the answer of a new request.
+ */
+static struct {
+    long reqid;
+    long msgid;
+} *shared_ids = NULL;
+
+/*
+ * snmp_share_session : session given to the checks by snmp_open_session
+ *			instead of opening their own (NULL : no more)
+ */
+
+void snmp_share_session(netsnmp_session *ss)
+{
+    shared_session = ss;
+
+    if (ss != NULL && shared_ids == NULL) {
+        shared_ids = mmap(NULL, sizeof(*shared_ids), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (shared_ids == MAP_FAILED)
+            shared_ids = NULL;
+    }
+}
+
+/* shared_ids_save : IDs after the ones used by this check (at its exit) */
+static void shared_ids_save(void)
+{
+    if (shared_ids != NULL) {
+        shared_ids->reqid = snmp_get_next_reqid();
+        shared_ids->msgid = snmp_get_next_msgid();
+    }
+}
+
+/* ids_skip : move an ID counter to after a value (the IDs are 31 bits) */
+static void ids_skip(long (*next)(void), long after)
+{
+    long count = (after - next()) & 0x7fffffffL;
+
+    /* Already after it */
+    if (count > 0x3fffffffL)
+        return;
+
+    while (count-- > 0)
+        next();
+}
+
+/*
+ * snmp_shared_fork : in a check forked by check_snmp, on the shared session,
+ *		      save its last IDs when it exits (exit() from anywhere,
+ *		      or snmp_shared_exit() before _exit())
+ */
+
+void snmp_shared_fork(void)
+{
+    atexit(shared_ids_save);
+}
+
+void snmp_shared_exit(void)
+{
+    shared_ids_save();
+}
+
+/*
+ * snmp_shared_wait : after a check, in check_snmp : the next check starts
+ *		      after the IDs it used, and its answers still on the
+ *		      socket of the session are dropped
+ */
+
+void snmp_shared_wait(void)
+{
+    netsnmp_transport *transport;
+    char buf[SNMP_MAX_LEN];
+    long count;
+
+    if (shared_ids != NULL && shared_ids->reqid != 0) {
+        ids_skip(snmp_get_next_reqid, shared_ids->reqid);
+        ids_skip(snmp_get_next_msgid, shared_ids->msgid);
+    } else {
+        /* The check was killed : past all the IDs it could have used */
+        for (count = 0; count < SHARED_IDS_MARGIN; count++) {
+            snmp_get_next_reqid();
+            snmp_get_next_msgid();
+        }
+    }
+    if (shared_ids != NULL)
+        shared_ids->reqid = shared_ids->msgid = 0;
+
+    if (shared_session != NULL && (transport = snmp_sess_transport(snmp_sess_pointer(shared_session))) != NULL) {
+        while (recv(transport->sock, buf, sizeof(buf), MSG_DONTWAIT) >= 0)
+            continue;
+    }
+}
+
+/*
+ * snmp_session_shared : the session was given by check_snmp, which saves
+ *			 the state of the host (RTT, keys) once, after all
+ *			 the checks : the checks don't
+ */
+
+int snmp_session_shared(netsnmp_session *ss)
+{
+    return ss != NULL && ss == shared_session;
+}
+
+netsnmp_session *snmp_open_session(netsnmp_session *session)
+{
+    netsnmp_session *ss;
+
+    if (shared_session)
+        return shared_session;
+
+    if ((ss = snmp_open(session)) != NULL)
+        stats_session(ss);
+
+    return ss;
+}
+
+void snmp_close_session(netsnmp_session *ss)
+{
+    if (ss != shared_session)
+        snmp_close(ss);
+}
+
+/*
+ * prefetch_root : subtree prefetched holding an OID
+ *
+ * return : index in prefetch.roots, or -1
+ */
+
+static int prefetch_root(const oid *name, size_t name_length)
+{
+    int count;
+
+    for (count = 0; count < prefetch.nroots; count++) {
+        if (name_length >= prefetch.roots[count].rootlen &&
+            !memcmp(prefetch.roots[count].root, name, prefetch.roots[count].rootlen * sizeof(oid)))
+            return count;
+    }
+
+    return -1;
+}
+
+/*
+ * prefetch_after : first object of a subtree after an OID (binary search)
+ */
+
+static int prefetch_after(const t_prefetch_root *root, const oid *name, size_t name_length)
+{
+    int low = 0, high = root->nvars, middle;
+
+    while (low < high) {
+        middle = (low + high) / 2;
+        if (snmp_oid_compare(root->vars[middle]->name, root->vars[middle]->name_length, name, name_length) <= 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    return low;
+}
+
+/*
+ * prefetch_visit : keep a copy of an object walked (snmp_walk visitor)
+ */
+
+static int prefetch_visit(int index, netsnmp_variable_list *vars, void *ctx)
+{
+    t_prefetch_root *root = &prefetch.roots[index];
+    netsnmp_variable_list *copy = NULL, **vars_new;
+
+    if (root->nvars == root->allocated) {
+        if ((vars_new = realloc(root->vars, (root->allocated ? root->allocated * 2 : 64) *
+                                sizeof(netsnmp_variable_list *))) == NULL)
+            return -1;
+        root->vars = vars_new;
+        root->allocated = root->allocated ? root->allocated * 2 : 64;
+    }
+
+    if (snmp_varlist_add_variable(&copy, vars->name, vars->name_length, vars->type, vars->val.string,
+                                  vars->val_len) == NULL)
+        return -1;
+
+    root->vars[root->nvars++] = copy;
+
+    return 0;
+}
+
+/*
+ * snmp_prefetch : walk several subtrees together and keep their objects
+ *
+ *	Each request has one varbind per subtree not finished yet : with
+ *	GETBULK, N subtrees of R objects cost about R / max-repetitions
+ *	requests instead of N times that.
+ *
+ *	args : ss = session, roots / rootlens / nroots = subtrees
+ *
+ * return : 0 if ok, -1 on error (nothing is prefetched)
+ */
+
+int snmp_prefetch(netsnmp_session *ss, oid **roots, size_t *rootlens, int nroots)
+{
+    int count;
+
+    prefetch_free();
+
+    if (nroots > PREFETCH_ROOTS_MAX)
+        nroots = PREFETCH_ROOTS_MAX;
+
+    for (count = 0; count < nroots; count++) {
+        memmove(prefetch.roots[count].root, roots[count], rootlens[count] * sizeof(oid));
+        prefetch.roots[count].rootlen = rootlens[count];
+    }
+
+    /* Only used once complete : not after a timeout, an error, or a copy
+     * which couldn't be allocated */
+    if (snmp_walk(ss, (const oid **)roots, rootlens, nroots, prefetch_visit, NULL) != 0) {
+        prefetch_free();
+        return -1;
+    }
+
+    prefetch.nroots = nroots;
+
+    return 0;
+}
+
+/*
+ * prefetch_next : answer a GETNEXT / GETBULK of getNextColumns
+ *
+ * return : response (to free with snmp_free_pdu), or NULL if one of the
+ *	    columns isn't in a prefetched subtree
+ */
+
+netsnmp_pdu *prefetch_next(oid **names, size_t *names_length, int ncolumns)
+{
+    netsnmp_pdu *pdu;
+    netsnmp_variable_list *vars;
+    t_prefetch_root *root;
+    int positions[PREFETCH_COLUMNS_MAX], roots[PREFETCH_COLUMNS_MAX];
+    int column, row, ended;
+
+    if (prefetch.nroots == 0 || ncolumns > PREFETCH_COLUMNS_MAX)
+        return NULL;
+
+    for (column = 0; column < ncolumns; column++) {
+        if ((roots[column] = prefetch_root(names[column], names_length[column])) < 0)
+            return NULL;
+        positions[column] = prefetch_after(&prefetch.roots[roots[column]], names[column], names_length[column]);
+    }
+
+    pdu = snmp_pdu_create(SNMP_MSG_RESPONSE);
+
+    for (row = 0, ended = 0; row < PREFETCH_ROWS && !ended; row++) {
+        for (column = 0, ended = 1; column < ncolumns; column++) {
+            root = &prefetch.roots[roots[column]];
+            if (positions[column] < root->nvars) {
+                vars = root->vars[positions[column]++];
+                snmp_pdu_add_variable(pdu, vars->name, vars->name_length, vars->type, vars->val.string,
+                                      vars->val_len);
+                ended = 0;
+            } else {
+                /* Same end as an agent with nothing after the subtree */
+                snmp_pdu_add_variable(pdu, names[column], names_length[column], SNMP_ENDOFMIBVIEW, NULL, 0);
+            }
+        }
+    }
+
+    return pdu;
+}
+
+/*
+ * prefetch_get : answer a GET of snmp_get_batch
+ *
+ *	args : name / name_length = OID, *vars = where its varbind is
+ *	       returned (NULL if the agent has no such object)
+ *
+ * return : 1 if the OID is in a prefetched subtree, else 0
+ */
+
+int prefetch_get(const oid *name, size_t name_length, netsnmp_variable_list **vars)
+{
+    t_prefetch_root *root;
+    int index;
+
+    if (prefetch.nroots == 0 || (index = prefetch_root(name, name_length)) < 0)
+        return 0;
+
+    root = &prefetch.roots[index];
+    index = prefetch_after(root, name, name_length) - 1;
+
+    *vars = NULL;
+    if (index >= 0 && !snmp_oid_compare(root->vars[index]->name, root->vars[index]->name_length, name, name_length))
+        *vars = root->vars[index];
+
+    return 1;
+}
+
+int prefetch_active(void)
+{
+    return prefetch.nroots > 0;
+}
+
+/*
+ * prefetch_free : forget the prefetched subtrees
+ */
+
+void prefetch_free(void)
+{
+    int count, index;
+
+    for (count = 0; count < PREFETCH_ROOTS_MAX; count++) {
+        for (index = 0; index < prefetch.roots[count].nvars; index++)
+            snmp_free_varbind(prefetch.roots[count].vars[index]);
+        free(prefetch.roots[count].vars);
+    }
+
+    memset(&prefetch, 0, sizeof(prefetch));
+}
@@ -0,0 +1,197 @@
+/*
+ *    snmp-state . Per host state files for Nagios snmp plugins
+ *
+ *    Copyright (C) 2006  Vincent GERARD v.ge@wanadoo.fr
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; see the file COPYING. If not, write to the
+ *    Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <net-snmp/net-snmp-config.h>
+#include <net-snmp/net-snmp-includes.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include "snmp-common.h"
+
+/*
+ * state_dir : the state directory, created (mode 0700) if needed
+ *
+ * It is usually under /var/tmp, where anyone can create it first : it is
+ * only used if it is a directory of the current user, that nobody else can
+ * write to. Otherwise the files could be replaced, or links planted in it.
+ *
+ * return : directory name or NULL if it can't be trusted
+ */
+
+static const char *state_dir(void)
+{
+    const char *dir;
+    struct stat st;
+
+    if ((dir = getenv(STATE_DIR_ENV)) == NULL || *dir == '\0')
+        dir = STATE_DIR;
+
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST)
+        return NULL;
+
+    if (lstat(dir, &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & 022))
+        return NULL;
+
+    return dir;
+}
+
+/*
+ * state_path : build the file name of a state file
+ *	args : peer = session peername, kind = file suffix
+ *	       path / length : where the name should be written
+ *	       tmp : if set, name of the temporary file used while writing
+ *
+ * Characters of the peername that can't be part of a file name are replaced.
+ *
+ * return : 0 if ok, -1 if the name is too long or the directory unsafe
+ */
+
+static int state_path(const char *peer, const char *kind, char *path, size_t length, int tmp)
+{
+    const char *dir;
+    char *p;
+    int n;
+
+    if ((dir = state_dir()) == NULL)
+        return -1;
+
+    n = snprintf(path, length, "%s/", dir);
+    if (n < 0 || (size_t)n >= length)
+        return -1;
+
+    /* peername, made safe for the file system */
+    for (p = path + n; *peer && p < path + length - 1; peer++, p++) {
+        *p = (*peer == '/' || *peer == '\\') ? '_' : *peer;
+    }
+    *p = '\0';
+
+    n = strlen(path);
+    if (tmp)
+        n += snprintf(path + n, length - n, ".%s.%ld", kind, (long)getpid());
+    else
+        n += snprintf(path + n, length - n, ".%s", kind);
+
+    if ((size_t)n >= length)
+        return -1;
+
+    return 0;
+}
+
+/*
+ * state_open_read : open the state file "kind" of the given peer
+ *
+ * Links, and files which don't belong to the current user or which can be
+ * read by others, are ignored : they may hold credentials.
+ *
+ * return : FILE pointer or NULL if there is no usable state
+ */
+
+FILE *state_open_read(const char *peer, const char *kind)
+{
+    char path[PATH_MAX];
+    struct stat st;
+    FILE *fp;
+    int fd;
+
+    if (peer == NULL || state_path(peer, kind, path, sizeof(path), 0) != 0)
+        return NULL;
+
+    if ((fd = open(path, O_RDONLY | O_NOFOLLOW | O_NONBLOCK)) < 0)
+        return NULL;
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & 077) ||
+        (fp = fdopen(fd, "r")) == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    return fp;
+}
+
+/*
+ * state_open_write : create a new state file, mode 0600
+ *
+ * The content is written in a temporary file, which replaces the previous
+ * state only when state_close_write() succeeds : checks running at the same
+ * time on the same host never read a partial file. The temporary file is
+ * always a new one : a file left by a process of the same pid is removed.
+ *
+ * return : FILE pointer or NULL on error
+ */
+
+FILE *state_open_write(const char *peer, const char *kind)
+{
+    char path[PATH_MAX];
+    FILE *fp;
+    int fd;
+
+    if (peer == NULL || state_path(peer, kind, path, sizeof(path), 1) != 0)
+        return NULL;
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0600)) < 0 &&
+        (errno != EEXIST || unlink(path) != 0 || (fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0600)) < 0))
+        return NULL;
+
+    if ((fp = fdopen(fd, "w")) == NULL) {
+        close(fd);
+        unlink(path);
+    }
+
+    return fp;
+}
+
+/*
+ * state_close_write : close a file opened with state_open_write and
+ *		       put it in place
+ *
+ * return : 0 if ok, -1 on error (the previous state is kept)
+ */
+
+int state_close_write(FILE *fp, const char *peer, const char *kind)
+{
+    char tmppath[PATH_MAX], path[PATH_MAX];
+    int err;
+
+    err = (fflush(fp) != 0) || ferror(fp);
+    err |= (fclose(fp) != 0);
+
+    if (state_path(peer, kind, tmppath, sizeof(tmppath), 1) != 0 || state_path(peer, kind, path, sizeof(path), 0) != 0)
+        return -1;
+
+    if (err || rename(tmppath, path) != 0) {
+        unlink(tmppath);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * state_remove : forget the state "kind" of the given peer
+ */
+
+void state_remove(const char *peer, const char *kind)
+{
+    char path[PATH_MAX];
+
+    if (peer != NULL && state_path(peer, kind, path, sizeof(path), 0) == 0)
+        unlink(path);
+}
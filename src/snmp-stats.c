@@ -0,0 +1,228 @@
+/*
+ *    snmp-stats . Cost of a check : requests, bytes, time of each phase (-S)
+ *
+ *    Copyright (C) 2006  Vincent GERARD v.ge@wanadoo.fr
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; see the file COPYING. If not, write to the
+ *    Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * The requests and their varbinds are counted where the checks send them
+ * (snmp_synch_request, snmp_get_batch), the datagrams and bytes by the
+ * transport of the session : a datagram sent that is not a new request is
+ * a retry. The SNMPv3 discovery of snmp_open() is done before the transport
+ * is counted.
+ *
+ * The plugins mark the start of each phase (init, keys, open, walk, get,
+ * output...) ; a phase seen again adds up. The time is taken from the
+ * monotonic clock.
+ */
+
+#include <net-snmp/net-snmp-config.h>
+#include <net-snmp/net-snmp-includes.h>
+#include <time.h>
+#include "snmp-common.h"
+
+#define STATS_PHASES_MAX 16
+
+typedef struct stats_phase {
+    const char *name;
+    double ms;
+} t_stats_phase;
+
+static struct {
+    int mode;
+    unsigned long requests, varbinds, timeouts, sent, bytes_out, bytes_in;
+    t_stats_phase phases[STATS_PHASES_MAX];
+    int nphases;
+    int current;                // phase running, -1 if none
+    struct timespec started;    // of the current phase
+} stats = { STATS_OFF, 0, 0, 0, 0, 0, 0, { { NULL, 0 } }, 0, -1, { 0, 0 } };
+
+/* Functions of the transport, called by the counting ones */
+static __typeof__(((netsnmp_transport *) 0)->f_send) transport_send;
+static __typeof__(((netsnmp_transport *) 0)->f_recv) transport_recv;
+
+/*
+ * stats_mode : parse the argument of -S
+ *
+ * return : STATS_STDERR, STATS_PERF, or -1 if unknown
+ */
+
+int stats_mode(const char *arg)
+{
+    if (!strcmp(arg, "stderr"))
+        return STATS_STDERR;
+    if (!strcmp(arg, "perf"))
+        return STATS_PERF;
+
+    return -1;
+}
+
+void stats_set_mode(int mode)
+{
+    stats.mode = mode;
+}
+
+/*
+ * stats_start : forget the counters and phases (check_snmp runs the checks
+ *		 in processes forked from its own), first phase "init"
+ */
+
+void stats_start(void)
+{
+    int mode = stats.mode;
+
+    memset(&stats, 0, sizeof(stats));
+    stats.mode = mode;
+    stats.current = -1;
+    stats_phase("init");
+}
+
+/*
+ * stats_phase : end the current phase, start another one
+ */
+
+void stats_phase(const char *name)
+{
+    struct timespec now;
+    int count;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if (stats.current >= 0)
+        stats.phases[stats.current].ms +=
+            (now.tv_sec - stats.started.tv_sec) * 1000.0 + (now.tv_nsec - stats.started.tv_nsec) / 1000000.0;
+
+    stats.started = now;
+    stats.current = -1;
+    if (name == NULL)
+        return;
+
+    for (count = 0; count < stats.nphases; count++) {
+        if (!strcmp(stats.phases[count].name, name))
+            break;
+    }
+    if (count == STATS_PHASES_MAX)
+        return;
+    if (count == stats.nphases) {
+        stats.phases[count].name = name;
+        stats.phases[count].ms = 0;
+        stats.nphases++;
+    }
+
+    stats.current = count;
+}
+
+/*
+ * stats_request : count a request sent by a check
+ */
+
+void stats_request(netsnmp_pdu *pdu)
+{
+    netsnmp_variable_list *vars;
+
+    stats.requests++;
+    for (vars = pdu->variables; vars; vars = vars->next_variable)
+        stats.varbinds++;
+}
+
+void stats_timeout(void)
+{
+    stats.timeouts++;
+}
+
+static int stats_send(netsnmp_transport *t, const void *buf, int size, void **opaque, int *olength)
+{
+    int sent = transport_send(t, (void *)buf, size, opaque, olength);
+
+    if (sent > 0) {
+        stats.sent++;
+        stats.bytes_out += sent;
+    }
+
+    return sent;
+}
+
+static int stats_recv(netsnmp_transport *t, void *buf, int size, void **opaque, int *olength)
+{
+    int received = transport_recv(t, buf, size, opaque, olength);
+
+    if (received > 0)
+        stats.bytes_in += received;
+
+    return received;
+}
+
+/*
+ * stats_session : count the datagrams and bytes of a session (once opened)
+ */
+
+void stats_session(netsnmp_session *ss)
+{
+    netsnmp_transport *t;
+
+    if ((t = snmp_sess_transport(snmp_sess_pointer(ss))) == NULL ||
+        t->f_send == (__typeof__(t->f_send))stats_send)
+        return;
+
+    transport_send = t->f_send;
+    transport_recv = t->f_recv;
+    t->f_send = (__typeof__(t->f_send))stats_send;
+    t->f_recv = (__typeof__(t->f_recv))stats_recv;
+}
+
+/*
+ * stats_print : end of a check, print its cost (-S)
+ *	stderr : two lines on stderr
+ *	perf   : a line of perfdata, after the output of the check (Nagios
+ *		 reads the perfdata of the long output after a '|')
+ */
+
+void stats_print(void)
+{
+    unsigned long retries;
+    double total = 0;
+    int count;
+
+    stats_phase(NULL);
+
+    if (stats.mode == STATS_OFF)
+        return;
+
+    retries = stats.sent > stats.requests ? stats.sent - stats.requests : 0;
+
+    for (count = 0; count < stats.nphases; count++)
+        total += stats.phases[count].ms;
+
+    fflush(stdout);
+
+    if (stats.mode == STATS_STDERR) {
+        fprintf(stderr, "STATS: %lu requests, %lu varbinds, %lu retries, %lu timeouts, %lu bytes sent, "
+                "%lu bytes received\nSTATS:", stats.requests, stats.varbinds, retries, stats.timeouts,
+                stats.bytes_out, stats.bytes_in);
+        for (count = 0; count < stats.nphases; count++)
+            fprintf(stderr, " %s %.3f ms,", stats.phases[count].name, stats.phases[count].ms);
+        fprintf(stderr, " total %.3f ms\n", total);
+        return;
+    }
+
+    printf("| snmp_requests=%lu snmp_varbinds=%lu snmp_retries=%lu snmp_timeouts=%lu snmp_sent=%luB "
+           "snmp_received=%luB", stats.requests, stats.varbinds, retries, stats.timeouts, stats.bytes_out,
+           stats.bytes_in);
+    for (count = 0; count < stats.nphases; count++)
+        printf(" time_%s=%.6fs", stats.phases[count].name, stats.phases[count].ms / 1000);
+    printf(" time_total=%.6fs\n", total / 1000);
+}